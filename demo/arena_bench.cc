@@ -0,0 +1,121 @@
+#include <twobot.hh>
+#include <arena.hh>
+#include <jsonex.hh>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+/// 事件内存池对每个事件堆分配次数的影响
+/// 与IO线程上的派发路径相同：解码事件json，构造事件对象并把json移入其中，监听器读取后事件连同内存池一起释放
+/// 堆分配包括EventJson的节点(来自getEventAllocStats)和进程中所有的operator new，后者也包含事件对象中的字符串和内存池自己的块
+/// 事件内容固定，结果可以重复比较
+
+using twobot::EventArena;
+using twobot::EventJson;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    std::atomic<uint64_t> g_news{ 0 };
+}
+
+void* operator new(std::size_t size) {
+    g_news.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+    std::vector<std::string> corpus(std::size_t count) {
+        std::vector<std::string> events;
+        for (std::size_t i = 0; i < count; ++i) {
+            auto text = "今天的会议改到下午三点，请大家准时参加 #" + std::to_string(i);
+            nlohmann::json sender = { {"user_id", 1122334455 + i % 50}, {"nickname", "成员" + std::to_string(i % 50)}, {"card", ""}, {"role", "member"} };
+            nlohmann::json message = { {{"type", "text"}, {"data", {{"text", text}}}}, {{"type", "face"}, {"data", {{"id", "178"}}}} };
+            switch (i % 4) {
+            case 0:
+            case 1:
+                events.push_back(nlohmann::json{
+                    {"time", 1729000000 + i}, {"self_id", 123456789}, {"post_type", "message"}, {"message_type", "group"},
+                    {"sub_type", "normal"}, {"message_id", -2147483000 + static_cast<int64_t>(i)}, {"group_id", 987654321},
+                    {"user_id", 1122334455 + i % 50}, {"message", message}, {"raw_message", text + "[CQ:face,id=178]"},
+                    {"font", 0}, {"sender", sender},
+                }.dump());
+                break;
+            case 2:
+                events.push_back(nlohmann::json{
+                    {"time", 1729000000 + i}, {"self_id", 123456789}, {"post_type", "message"}, {"message_type", "private"},
+                    {"sub_type", "friend"}, {"message_id", -2147483000 + static_cast<int64_t>(i)}, {"user_id", 1122334455 + i % 50},
+                    {"message", message}, {"raw_message", text + "[CQ:face,id=178]"}, {"font", 0}, {"sender", sender},
+                }.dump());
+                break;
+            default:
+                events.push_back(nlohmann::json{
+                    {"time", 1729000000 + i}, {"self_id", 123456789}, {"post_type", "notice"}, {"notice_type", "group_recall"},
+                    {"group_id", 987654321}, {"user_id", 1122334455 + i % 50}, {"operator_id", 1122334455 + i % 50},
+                    {"message_id", -2147483000 + static_cast<int64_t>(i - 1)},
+                }.dump());
+                break;
+            }
+        }
+        return events;
+    }
+
+    void run(const char* label, const std::vector<std::string>& events, bool event_arena) {
+        auto before = twobot::getEventAllocStats();
+        auto news = g_news.load();
+        int64_t sink = 0;
+        auto begin = Clock::now();
+        for (const auto& payload : events) {
+            auto arena = event_arena ? EventArena::acquire() : nullptr;
+            EventJson json_payload;
+            {
+                twobot::ArenaScope scope(arena.get());
+                json_payload = EventJson::parse(payload);
+            }
+            twobot::countDecodedEvent();
+            std::string post_type = json_payload.value("post_type", "");
+            std::string sub_type = json_payload.value(post_type == "message" ? "message_type" : "notice_type", "");
+            auto event = twobot::Event::construct({ post_type, sub_type });
+            if (!event.has_value())
+                continue;
+            std::visit([&](auto&& e) {
+                e.raw_msg = std::move(json_payload);
+                e.raw_msg.get_to(e);
+                sink += e.raw_msg.value("user_id", int64_t(0));
+            }, *event);
+        }
+        auto seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        auto after = twobot::getEventAllocStats();
+        auto decoded = static_cast<double>(after.events - before.events);
+        std::cout << label << std::endl
+            << "  EventJson heap allocations/event " << (after.heap - before.heap) / decoded
+            << ", arena allocations/event " << (after.arena - before.arena) / decoded << std::endl
+            << "  operator new/event " << (g_news.load() - news) / decoded
+            << ", " << events.size() / seconds << " events/s" << std::endl
+            << "  (sink " << sink << ")" << std::endl;
+    }
+}
+
+int main(int argc, char** args) {
+    std::size_t count = argc > 1 ? std::stoul(args[1]) : 100000;
+    auto events = corpus(count);
+    // 先各跑一轮，让内存池的缓存和分配器进入稳定状态
+    run("warm-up, event_arena off", events, false);
+    run("warm-up, event_arena on", events, true);
+    run("event_arena off", events, false);
+    run("event_arena on", events, true);
+    return 0;
+}
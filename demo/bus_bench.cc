@@ -0,0 +1,111 @@
+#include <bus.hh>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <thread>
+
+/// 共享内存事件总线与进程内监听器的吞吐对比
+/// 进程内：事件json经加锁队列交给工作线程，相当于投递到线程池
+/// 事件总线：事件编码为MessagePack写入共享内存，消费者通过另一份映射读出、解码后交给同样的监听器
+/// 消费者在线程中运行只是为了方便同步计数，读写路径与跨进程时完全相同
+
+using twobot::BusConsumer;
+using twobot::EventBus;
+using twobot::EventBusConfig;
+using twobot::EventType;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    nlohmann::json sampleEvent() {
+        return {
+            {"time", 1729000000},
+            {"self_id", 123456789},
+            {"post_type", "message"},
+            {"message_type", "group"},
+            {"sub_type", "normal"},
+            {"message_id", -2147483000},
+            {"group_id", 987654321},
+            {"user_id", 1122334455},
+            {"message", {{{"type", "text"}, {"data", {{"text", "今天的会议改到下午三点，请大家准时参加"}}}}}},
+            {"raw_message", "今天的会议改到下午三点，请大家准时参加"},
+            {"font", 0},
+            {"sender", {{"user_id", 1122334455}, {"nickname", "张三"}, {"card", ""}, {"role", "member"}}},
+        };
+    }
+
+    int64_t handler(const nlohmann::json& event) {
+        return event["message_id"].get<int64_t>() + static_cast<int64_t>(event["raw_message"].get_ref<const std::string&>().size());
+    }
+
+    double inProcess(const nlohmann::json& sample, std::size_t count) {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<nlohmann::json> queue;
+        int64_t sink = 0;
+        auto begin = Clock::now();
+        std::thread worker([&] {
+            for (std::size_t handled = 0; handled < count; ++handled) {
+                std::unique_lock lock(mtx);
+                cv.wait(lock, [&] { return !queue.empty(); });
+                auto event = std::move(queue.front());
+                queue.pop_front();
+                lock.unlock();
+                sink += handler(event);
+            }
+        });
+        for (std::size_t i = 0; i < count; ++i) {
+            {
+                std::lock_guard lock(mtx);
+                queue.push_back(sample);
+            }
+            cv.notify_one();
+        }
+        worker.join();
+        auto seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        std::cout << "  (sink " << sink << ")" << std::endl;
+        return count / seconds;
+    }
+
+    double overBus(const nlohmann::json& sample, std::size_t count) {
+        EventBus bus(EventBusConfig{ "bench" });
+        EventType type{ "message", "group" };
+        BusConsumer consumer("bench", { type });
+        std::atomic<std::size_t> consumed{ 0 };
+        int64_t sink = 0;
+        auto begin = Clock::now();
+        std::thread worker([&] {
+            while (consumed < count) {
+                auto event = consumer.next(std::chrono::seconds(1));
+                if (!event)
+                    break;
+                sink += handler(event->data);
+                consumed.fetch_add(1, std::memory_order_release);
+            }
+        });
+        // 总线不等待慢的消费者，这里限制领先的条数，避免测到的是丢弃的速度
+        for (std::size_t i = 0; i < count; ++i) {
+            while (i - consumed.load(std::memory_order_acquire) > 4096)
+                std::this_thread::yield();
+            bus.publish(type, 123456789, 1729000000, nlohmann::json::to_msgpack(sample));
+        }
+        worker.join();
+        auto seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        std::cout << "  (sink " << sink << ", overruns " << consumer.overruns() << ")" << std::endl;
+        return consumed / seconds;
+    }
+}
+
+int main(int argc, char** args) {
+    std::size_t count = argc > 1 ? std::stoul(args[1]) : 200000;
+    auto sample = sampleEvent();
+    std::cout << "event: " << sample.dump().size() << " bytes json, "
+        << nlohmann::json::to_msgpack(sample).size() << " bytes msgpack" << std::endl;
+
+    auto local = inProcess(sample, count);
+    std::cout << "in-process handler: " << static_cast<uint64_t>(local) << " events/s" << std::endl;
+    auto remote = overBus(sample, count);
+    std::cout << "event bus:          " << static_cast<uint64_t>(remote) << " events/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <deflate.hh>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// permessage-deflate的压缩率和每条消息的开销
+/// 压缩：与发送路径相同，同一个上下文按顺序压缩每条消息
+/// 解压：与正向WS的接收路径相同，协商了压缩的连接上每条消息都直接解压
+/// 消息内容固定，结果可以重复比较
+
+using twobot::DeflateConfig;
+using twobot::PerMessageDeflate;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    std::string groupMessage(std::size_t i) {
+        return nlohmann::json{
+            {"time", 1729000000 + i},
+            {"self_id", 123456789},
+            {"post_type", "message"},
+            {"message_type", "group"},
+            {"sub_type", "normal"},
+            {"message_id", -2147483000 + static_cast<int64_t>(i)},
+            {"group_id", 987654321},
+            {"user_id", 1122334455 + i % 50},
+            {"message", {{{"type", "text"}, {"data", {{"text", "今天的会议改到下午三点，请大家准时参加 #" + std::to_string(i)}}}}}},
+            {"raw_message", "今天的会议改到下午三点，请大家准时参加 #" + std::to_string(i)},
+            {"font", 0},
+            {"sender", {{"user_id", 1122334455 + i % 50}, {"nickname", "成员" + std::to_string(i % 50)}, {"card", ""}, {"role", "member"}}},
+        }.dump();
+    }
+
+    std::string memberList(std::size_t members) {
+        auto data = nlohmann::json::array();
+        for (std::size_t i = 0; i < members; ++i) {
+            data.push_back({
+                {"group_id", 987654321},
+                {"user_id", 1000000 + i * 7919},
+                {"nickname", "成员" + std::to_string(i)},
+                {"card", i % 3 == 0 ? "" : "名片" + std::to_string(i)},
+                {"sex", i % 2 ? "male" : "female"},
+                {"age", 18 + i % 40},
+                {"join_time", 1600000000 + i * 3600},
+                {"last_sent_time", 1729000000 - i * 60},
+                {"level", std::to_string(i % 100)},
+                {"role", i == 0 ? "owner" : "member"},
+                {"unfriendly", false},
+                {"card_changeable", true},
+            });
+        }
+        return nlohmann::json{ {"status", "ok"}, {"retcode", 0}, {"data", data}, {"echo", 42} }.dump();
+    }
+
+    template <typename F>
+    double microsPerCall(std::size_t count, F&& body) {
+        auto begin = Clock::now();
+        for (std::size_t i = 0; i < count; ++i)
+            body(i);
+        return std::chrono::duration<double, std::micro>(Clock::now() - begin).count() / count;
+    }
+
+    void run(const char* label, const std::vector<std::string>& messages, bool no_context_takeover) {
+        DeflateConfig config;
+        config.client_no_context_takeover = no_context_takeover;
+        config.server_no_context_takeover = no_context_takeover;
+        PerMessageDeflate sender(config, 15, no_context_takeover, no_context_takeover);
+        PerMessageDeflate receiver(config, 15, no_context_takeover, no_context_takeover);
+
+        std::vector<std::string> compressed(messages.size());
+        std::size_t raw_bytes = 0;
+        std::size_t compressed_bytes = 0;
+        auto compress = microsPerCall(messages.size(), [&](std::size_t i) {
+            compressed[i] = sender.compress(messages[i]);
+        });
+        for (std::size_t i = 0; i < messages.size(); ++i) {
+            raw_bytes += messages[i].size();
+            compressed_bytes += compressed[i].size();
+        }
+
+        std::size_t mismatches = 0;
+        auto inflate = microsPerCall(messages.size(), [&](std::size_t i) {
+            if (receiver.decompress(compressed[i]) != messages[i])
+                ++mismatches;
+        });
+
+        std::cout << label << (no_context_takeover ? ", no context takeover" : ", context takeover") << std::endl
+            << "  " << raw_bytes / messages.size() << " -> " << compressed_bytes / messages.size() << " bytes/message" << std::endl
+            << "  compress " << compress << " us, decompress " << inflate << " us" << std::endl
+            << "  mismatches " << mismatches << std::endl;
+    }
+}
+
+int main(int argc, char** args) {
+    std::size_t count = argc > 1 ? std::stoul(args[1]) : 20000;
+
+    std::vector<std::string> events;
+    for (std::size_t i = 0; i < count; ++i)
+        events.push_back(groupMessage(i));
+    std::vector<std::string> lists(std::max<std::size_t>(count / 1000, 4), memberList(1000));
+
+    for (bool no_context_takeover : { false, true }) {
+        run("group message", events, no_context_takeover);
+        run("member list", lists, no_context_takeover);
+    }
+    return 0;
+}
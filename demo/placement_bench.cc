@@ -0,0 +1,101 @@
+#include <twobot.hh>
+#include <affinity.hh>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// 线程放置对事件分发延迟的影响
+/// 解码线程相当于IO线程：解析事件json后投递到通道的执行器，记录从投递到处理函数开始执行的时间
+/// 处理函数读取解码线程刚写入的事件，放置不当时这些数据要跨核(或跨节点)搬运
+/// 每次投递前等待上一个事件处理完，测的是单个事件的延迟而不是吞吐
+
+using twobot::Lane;
+using twobot::LaneConfig;
+using twobot::LaneConfigs;
+using twobot::Placement;
+using twobot::Runtime;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    std::string groupMessage(std::size_t i) {
+        return nlohmann::json{
+            {"time", 1729000000 + i},
+            {"self_id", 123456789},
+            {"post_type", "message"},
+            {"message_type", "group"},
+            {"sub_type", "normal"},
+            {"message_id", -2147483000 + static_cast<int64_t>(i)},
+            {"group_id", 987654321},
+            {"user_id", 1122334455 + i % 50},
+            {"message", {{{"type", "text"}, {"data", {{"text", "今天的会议改到下午三点，请大家准时参加 #" + std::to_string(i)}}}}}},
+            {"raw_message", "今天的会议改到下午三点，请大家准时参加 #" + std::to_string(i)},
+            {"font", 0},
+            {"sender", {{"user_id", 1122334455 + i % 50}, {"nickname", "成员" + std::to_string(i % 50)}, {"card", ""}, {"role", "member"}}},
+        }.dump();
+    }
+
+    double micros(Clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    }
+
+    void run(const char* label, const std::vector<std::string>& messages, std::optional<LaneConfigs> lanes, const Placement& placement) {
+        auto runtime = Runtime::create(1, 1, lanes, placement);
+        auto executor = runtime->executor(Lane::INTERACTIVE);
+
+        std::vector<double> latencies(messages.size());
+        int64_t sink = 0;
+        std::thread decoder([&] {
+            twobot::pinCurrentThread(placement.io_cpus);
+            std::atomic<std::size_t> handled{ 0 };
+            for (std::size_t i = 0; i < messages.size(); ++i) {
+                auto event = std::make_shared<nlohmann::json>(nlohmann::json::parse(messages[i]));
+                auto posted = Clock::now();
+                executor([&, i, event, posted] {
+                    latencies[i] = micros(Clock::now() - posted);
+                    sink += (*event)["message_id"].get<int64_t>() + static_cast<int64_t>((*event)["raw_message"].get_ref<const std::string&>().size());
+                    handled.store(i + 1, std::memory_order_release);
+                });
+                while (handled.load(std::memory_order_acquire) != i + 1)
+                    std::this_thread::yield();
+            }
+        });
+        decoder.join();
+
+        std::sort(latencies.begin(), latencies.end());
+        auto at = [&](double q) { return latencies[static_cast<std::size_t>(q * (latencies.size() - 1))]; };
+        std::cout << label << std::endl
+            << "  p50 " << at(0.5) << " us, p99 " << at(0.99) << " us, p99.9 " << at(0.999) << " us, max " << latencies.back() << " us" << std::endl
+            << "  (sink " << sink << ")" << std::endl;
+    }
+}
+
+int main(int argc, char** args) {
+    std::size_t count = argc > 1 ? std::stoul(args[1]) : 100000;
+    // 默认解码线程用CPU 0，事件线程用CPU 1，可以分别指定，例如放到不同的NUMA节点上对比
+    int io_cpu = argc > 2 ? std::stoi(args[2]) : 0;
+    int worker_cpu = argc > 3 ? std::stoi(args[3]) : 1;
+    if (std::thread::hardware_concurrency() < 2) {
+        std::cout << "need at least 2 CPUs" << std::endl;
+        return 0;
+    }
+
+    std::vector<std::string> messages;
+    for (std::size_t i = 0; i < count; ++i)
+        messages.push_back(groupMessage(i));
+
+    LaneConfigs lanes{};
+    for (auto& lane : lanes)
+        lane = { 1, LaneConfig::Priority::NORMAL };
+    Placement pinned{ { io_cpu }, { worker_cpu } };
+
+    run("thread pool, unpinned", messages, std::nullopt, {});
+    run("thread pool, pinned", messages, std::nullopt, pinned);
+    run("lanes, unpinned", messages, lanes, {});
+    run("lanes, pinned", messages, lanes, pinned);
+    return 0;
+}
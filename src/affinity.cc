@@ -0,0 +1,34 @@
+#include "affinity.hh"
+#include <iostream>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace twobot {
+    bool pinCurrentThread(const std::vector<int>& cpus) {
+        if (cpus.empty())
+            return false;
+#ifdef _WIN32
+        DWORD_PTR mask = 0;
+        for (auto cpu : cpus)
+            if (cpu >= 0 && cpu < static_cast<int>(sizeof(DWORD_PTR) * 8))
+                mask |= DWORD_PTR(1) << cpu;
+        if (mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0)
+            return true;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu : cpus)
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+            return true;
+#endif
+        std::cerr << "Thread Affinity Error: cannot pin thread" << std::endl;
+        return false;
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <vector>
+
+namespace twobot {
+    // 把当前线程限制在cpus上，cpus为空或平台不支持时什么也不做，返回是否成功
+    bool pinCurrentThread(const std::vector<int>& cpus);
+}
@@ -5,49 +5,90 @@
 #include <utility>
 #include <brynet/net/http/HttpService.hpp>
 #include <tbb/tbb.h>
+#include "context.hh"
+#include "jsonex.hh"
+#include "stream.hh"
 
 namespace twobot 
 {
     extern std::atomic<std::size_t> g_seq = 0;
-    using PromMapType = tbb::concurrent_hash_map<std::size_t, std::promise<ApiSet::SyncResult>>;
-    extern PromMapType g_promMap;
-    using brynet::net::http::HttpSession;
-    using SessionMapType = tbb::concurrent_unordered_map<uint64_t, HttpSession::Ptr>;
-    extern SessionMapType g_sessionMap;
     template<class... Ts> struct overload : Ts... { using Ts::operator()...; };
     template<class... Ts> overload(Ts...) -> overload<Ts...>;
 
-    inline ApiSet::ApiResult callApiAsync(const std::string& api_name, const nlohmann::json& data, const ApiSet::AsyncConfig config, const ApiSet::AsyncMode& mode)
+    // 发送已经带好echo的帧，need_resp时登记等待响应
+    inline ApiSet::ApiResult _send_frame(const std::string& api_name, std::size_t seq, std::string frame, bool need_resp, uint64_t id, BotContext& ctx, ApiSet::ElementCallback stream = nullptr)
+    {
+        auto state = std::make_shared<ApiSet::ApiResult::State>();
+        state->executor = ctx.callerExecutor();
+        ApiSet::ApiResult ret{ state };
+        auto span = TraceSpan::begin(api_name);
+        if (need_resp)
+        {
+            ctx.pending.add(seq, state, std::move(stream), std::move(span));
+        }
+        else
+        {
+            span.end(true);
+        }
+        using SendStatus = SessionRegistry::SendStatus;
+        auto status = ctx.sessions.send(id, std::move(frame), need_resp ? std::optional<std::size_t>(seq) : std::nullopt);
+        if (status == SendStatus::UNKNOWN || status == SendStatus::QUEUE_FULL)
+        {
+            if (need_resp)
+            {
+                if (auto call = ctx.pending.take(seq))
+                    call->span.end(false);
+            }
+            ctx.metrics.record(Transport::WEBSOCKET, 0, false);
+            state->set({ false, {
+                {"error", status == SendStatus::UNKNOWN ? "bot is not connected" : "send queue is full"}
+            } });
+        }
+        else if (!need_resp)
+        {
+            state->set({ false, {} });
+        }
+        return ret;
+    }
+
+    inline ApiSet::ApiResult callApiAsync(const std::string& api_name, const nlohmann::json& data, const ApiSet::AsyncConfig config, const ApiSet::AsyncMode& mode, BotContext& ctx, ApiSet::ElementCallback stream = nullptr)
     {
-        ApiSet::ApiResult ret;
-        std::promise<ApiSet::SyncResult> prom;
         nlohmann::json content =
         {
             {"action", api_name.substr(1)},
             {"params", data},
         };
         std::size_t seq = g_seq++;
-        ret = prom.get_future();
         if (mode.needResp)
         {
             content["echo"]["seq"] = seq;
-            g_promMap.insert({ seq, std::move(prom) });
         }
-        else
+        return _send_frame(api_name, seq, content.dump(), mode.needResp, config.id, ctx, std::move(stream));
+    }
+
+    // 参数已经序列化好，只拼接帧，不再经过nlohmann::json
+    inline ApiSet::ApiResult callApiAsyncRaw(const std::string& api_name, const std::string& params, const ApiSet::AsyncConfig config, const ApiSet::AsyncMode& mode, BotContext& ctx)
+    {
+        std::size_t seq = g_seq++;
+        std::string frame;
+        frame.reserve(params.size() + api_name.size() + 64);
+        frame += "{\"action\":\"";
+        frame.append(api_name, 1);
+        frame += "\",";
+        if (mode.needResp)
         {
-            prom.set_value({ false, {} });
+            frame += "\"echo\":{\"seq\":";
+            frame += std::to_string(seq);
+            frame += "},";
         }
-        auto wsFrame = brynet::net::http::WebSocketFormat::wsFrameBuild(content.dump());
-        g_sessionMap[config.id]->send(std::move(wsFrame));
-        return ret;
+        frame += "\"params\":";
+        frame += params;
+        frame += "}";
+        return _send_frame(api_name, seq, std::move(frame), mode.needResp, config.id, ctx);
     }
 
-    inline ApiSet::ApiResult callApiSync(const std::string& api_name, const nlohmann::json& data, const ApiSet::SyncConfig& config, const ApiSet::SyncMode& mode)
+    inline httplib::Headers _headers(const ApiSet::SyncConfig& config)
     {
-        ApiSet::ApiResult ret;
-        std::promise<ApiSet::SyncResult> prom;
-        ApiSet::SyncResult result{ false, {} };
-        httplib::Client client(config.host, config.port);
         httplib::Headers headers = {
             {"Content-Type", "application/json"}
         };
@@ -59,55 +100,172 @@ namespace twobot
                 )
             );
         }
-        httplib::Response response = {};
+        return headers;
+    }
 
-        if (mode.isPost)
-        {
-            auto r = client.Post(
+    // GET请求的查询参数，非字符串的值按json序列化，例如group_id=123、no_cache=true
+    inline httplib::Params _params(const nlohmann::json& data)
+    {
+        httplib::Params params;
+        if (!data.is_object())
+            return params;
+        for (auto& [key, value] : data.items())
+            params.emplace(key, value.is_string() ? value.get<std::string>() : value.dump());
+        return params;
+    }
+
+    inline ApiSet::SyncResult _sync_result(const httplib::Response& response, std::chrono::steady_clock::time_point begin, BotContext& ctx)
+    {
+        ApiSet::SyncResult result{ false, {} };
+        bool delivered = (response.status == 200);
+        try {
+            result.second = nlohmann::json::parse(response.body, nullptr, delivered);
+        }
+        catch (const std::exception& e) {
+            result.second = nlohmann::json{
+                {"error",e.what()}
+            };
+        }
+        // 与WS一致按envelope判断，HTTP 200但retcode非0的调用同样失败
+        result.first = delivered && succeeded(result.second);
+        std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - begin;
+        ctx.metrics.record(Transport::HTTP, latency.count(), result.first);
+        return result;
+    }
+
+    // 阻塞的HTTP请求在运行时的HTTP线程中执行并完成结果，调用线程立即返回；还没有启动时没有运行时，在调用线程上执行
+    inline ApiSet::ApiResult _run_http(const std::shared_ptr<BotContext>& ctx, std::function<ApiSet::SyncResult(BotContext&)> request)
+    {
+        if (!ctx->runtime)
+            return ApiSet::ApiResult::fromValue(request(*ctx));
+        auto state = std::make_shared<ApiSet::ApiResult::State>();
+        state->executor = ctx->callerExecutor();
+        // 计入tasks，stop()等待请求完成；先释放context再计数，stop()返回之后不会在HTTP线程上析构context
+        auto tasks = ctx->tasks;
+        tasks->started();
+        ctx->runtime->impl().submitHttp([ctx = ctx, tasks, state, request = std::move(request)]() mutable {
+            try {
+                state->set(request(*ctx));
+            }
+            catch (...) {
+                state->setError(std::current_exception());
+            }
+            ctx = nullptr;
+            state = nullptr;
+            request = nullptr;
+            tasks->finished();
+        });
+        return ApiSet::ApiResult{ state };
+    }
+
+    // 以POST发送已经序列化好的请求体
+    inline ApiSet::ApiResult callApiSyncRaw(const std::string& api_name, std::string body, const ApiSet::SyncConfig& config, const std::shared_ptr<BotContext>& ctx)
+    {
+        return _run_http(ctx, [api_name, body = std::move(body), config](BotContext& ctx) {
+            auto span = TraceSpan::begin(api_name);
+            auto begin = std::chrono::steady_clock::now();
+            auto client = ctx.http.acquire();
+            httplib::Response response = {};
+            auto r = client->Post(
                 api_name,
-                headers,
-                data.dump(),
+                _headers(config),
+                body,
                 "application/json"
             );
+            // 连接出错的客户端直接丢弃，下次重新建立
             if (r != nullptr) {
                 response = *r;
+                ctx.http.release(std::move(client));
             }
-        }
-        else
-        {
-            httplib::Params params = {};
-            if (!data.empty())
-            {
-                params = data;
-            }
-            auto r = client.Get(api_name, params, headers);
+            span.end(response.status == 200);
+            return _sync_result(response, begin, ctx);
+        });
+    }
+
+    inline ApiSet::ApiResult callApiSync(const std::string& api_name, const nlohmann::json& data, const ApiSet::SyncConfig& config, const ApiSet::SyncMode& mode, const std::shared_ptr<BotContext>& ctx)
+    {
+        if (mode.isPost)
+            return callApiSyncRaw(api_name, data.dump(), config, ctx);
+
+        return _run_http(ctx, [api_name, params = _params(data), config](BotContext& ctx) {
+            auto span = TraceSpan::begin(api_name);
+            auto begin = std::chrono::steady_clock::now();
+            auto client = ctx.http.acquire();
+            httplib::Response response = {};
+            auto r = client->Get(api_name, params, _headers(config));
+            // 连接出错的客户端直接丢弃，下次重新建立
             if (r != nullptr) {
                 response = *r;
+                ctx.http.release(std::move(client));
             }
-        }
+            span.end(response.status == 200);
+            return _sync_result(response, begin, ctx);
+        });
+    }
 
-        result.first = (response.status == 200);
+    inline ApiSet::ApiResult callApiAuto(const std::string& api_name, const nlohmann::json& data, const ApiSet::AutoConfig& config, const std::shared_ptr<BotContext>& ctx)
+    {
+        if (ctx->sessions.state(config.id) == ConnState::CONNECTED && ctx->metrics.choose() == Transport::WEBSOCKET)
+            return callApiAsync(api_name, data, { config.id }, { true }, *ctx);
+        return callApiSync(api_name, data, config.http, { true }, ctx);
+    }
 
-        try {
-            result.second = nlohmann::json::parse(response.body, nullptr, !result.first);
-        }
-        catch (const std::exception& e) {
-            result.second = nlohmann::json{
-                {"error",e.what()}
-            };
+    // 响应体边收边扫描，回调在调用线程上执行；httplib只有GET支持接收回调，所以流式调用总是GET
+    inline ApiSet::ApiResult callApiStreamSync(const std::string& api_name, const nlohmann::json& data, const ApiSet::SyncConfig& config, const ApiSet::ElementCallback& callback, BotContext& ctx)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        auto client = ctx.http.acquire();
+        auto params = _params(data);
+        int status = -1;
+        std::string error;
+        ResponseStream stream(callback);
+        auto r = client->Get(api_name, params, _headers(config),
+            [&status](const httplib::Response& response) {
+                status = response.status;
+                return true;
+            },
+            [&stream, &error](const char* chunk, size_t length) {
+                try {
+                    stream.feed({ chunk, length });
+                    return true;
+                }
+                catch (const std::exception& e) {
+                    error = e.what();
+                    return false;
+                }
+            });
+        // 中途取消的连接里还有没读完的数据，不能复用
+        if (r != nullptr)
+            ctx.http.release(std::move(client));
+
+        ApiSet::SyncResult result{ false, {} };
+        if (!error.empty())
+            result.second = nlohmann::json{ {"error", error} };
+        else {
+            result.second = nlohmann::json::parse(stream.envelope(), nullptr, false);
+            result.first = status == 200 && succeeded(result.second);
         }
-        ret = prom.get_future();
-        prom.set_value(result);
-        return ret;
+        std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - begin;
+        ctx.metrics.record(Transport::HTTP, latency.count(), result.first);
+        return ApiSet::ApiResult::fromValue(std::move(result));
+    }
+
+    template<typename T>
+    inline ApiSet::ElementCallback _typed(std::function<void(const T&)> callback)
+    {
+        return [callback = std::move(callback)](std::string_view element) {
+            callback(nlohmann::json::parse(element).get<T>());
+        };
     }
 
     bool ApiSet::testConnection() {
         return callApi("/get_version_info", {}).get().first;
     }
 
-	ApiSet::ApiSet(const ApiConfig& config, const ApiSet::ApiMode& mode)
+	ApiSet::ApiSet(const ApiConfig& config, const ApiSet::ApiMode& mode, std::shared_ptr<BotContext> ctx)
         : m_config(config)
         , m_mode(mode)
+        , m_ctx(std::move(ctx))
     {
 
     }
@@ -115,13 +273,63 @@ namespace twobot
     ApiSet::ApiResult ApiSet::callApi(const std::string &api_name, const nlohmann::json &data) {
 		auto callApiImpl = overload{
             [&](AsyncConfig config, AsyncMode mode) {
-                return callApiAsync(api_name, data, config, mode);
+                return callApiAsync(api_name, data, config, mode, *m_ctx);
             },
             [&](SyncConfig config, SyncMode mode) {
-                return callApiSync(api_name, data, config, mode);
+                return callApiSync(api_name, data, config, mode, m_ctx);
             },
-            [](AsyncConfig, SyncMode) -> ApiResult { return {}; },
-            [](SyncConfig, AsyncMode) -> ApiResult { return {}; }
+            [&](AutoConfig config, AutoMode) {
+                return callApiAuto(api_name, data, config, m_ctx);
+            },
+            [](auto, auto) {
+                return ApiResult::fromValue({ false, {
+                    {"error", "mismatched ApiConfig and ApiMode"}
+                } });
+            }
+        };
+        return std::visit(callApiImpl, m_config, m_mode);
+    }
+
+    ApiSet::ApiResult ApiSet::callApiRaw(const std::string &api_name, const std::string &params) {
+        auto callApiImpl = overload{
+            [&](AsyncConfig config, AsyncMode mode) {
+                return callApiAsyncRaw(api_name, params, config, mode, *m_ctx);
+            },
+            [&](SyncConfig config, SyncMode) {
+                return callApiSyncRaw(api_name, params, config, m_ctx);
+            },
+            [&](AutoConfig config, AutoMode) {
+                if (m_ctx->sessions.state(config.id) == ConnState::CONNECTED && m_ctx->metrics.choose() == Transport::WEBSOCKET)
+                    return callApiAsyncRaw(api_name, params, { config.id }, { true }, *m_ctx);
+                return callApiSyncRaw(api_name, params, config.http, m_ctx);
+            },
+            [](auto, auto) {
+                return ApiResult::fromValue({ false, {
+                    {"error", "mismatched ApiConfig and ApiMode"}
+                } });
+            }
+        };
+        return std::visit(callApiImpl, m_config, m_mode);
+    }
+
+    ApiSet::ApiResult ApiSet::callApiStream(const std::string &api_name, const nlohmann::json &data, ElementCallback callback) {
+        auto callApiImpl = overload{
+            [&](AsyncConfig config, AsyncMode) {
+                return callApiAsync(api_name, data, config, { true }, *m_ctx, std::move(callback));
+            },
+            [&](SyncConfig config, SyncMode) {
+                return callApiStreamSync(api_name, data, config, callback, *m_ctx);
+            },
+            [&](AutoConfig config, AutoMode) {
+                if (m_ctx->sessions.state(config.id) == ConnState::CONNECTED && m_ctx->metrics.choose() == Transport::WEBSOCKET)
+                    return callApiAsync(api_name, data, { config.id }, { true }, *m_ctx, std::move(callback));
+                return callApiStreamSync(api_name, data, config.http, callback, *m_ctx);
+            },
+            [](auto, auto) {
+                return ApiResult::fromValue({ false, {
+                    {"error", "mismatched ApiConfig and ApiMode"}
+                } });
+            }
         };
         return std::visit(callApiImpl, m_config, m_mode);
     }
@@ -316,6 +524,11 @@ namespace twobot
         return callApi("/get_friend_list", {});
     }
 
+    // ApiResult getFriendList(std::function<void(const FriendInfo&)> callback);
+    ApiSet::ApiResult ApiSet::getFriendList(std::function<void(const FriendInfo&)> callback){
+        return callApiStream("/get_friend_list", {}, _typed(std::move(callback)));
+    }
+
     // ApiResult getGroupInfo(uint64_t group_id, bool no_cache = false);
     ApiSet::ApiResult ApiSet::getGroupInfo(uint64_t group_id, bool no_cache){
         nlohmann::json data = {
@@ -330,6 +543,11 @@ namespace twobot
         return callApi("/get_group_list", {});
     }
 
+    // ApiResult getGroupList(std::function<void(const GroupInfo&)> callback);
+    ApiSet::ApiResult ApiSet::getGroupList(std::function<void(const GroupInfo&)> callback){
+        return callApiStream("/get_group_list", {}, _typed(std::move(callback)));
+    }
+
     // ApiResult getGroupMemberInfo(uint64_t group_id, uint64_t user_id, bool no_cache = false);
     ApiSet::ApiResult ApiSet::getGroupMemberInfo(uint64_t group_id, uint64_t user_id, bool no_cache){
         nlohmann::json data = {
@@ -348,6 +566,14 @@ namespace twobot
         return callApi("/get_group_member_list", data);
     }
 
+    // ApiResult getGroupMemberList(uint64_t group_id, std::function<void(const GroupMemberInfo&)> callback);
+    ApiSet::ApiResult ApiSet::getGroupMemberList(uint64_t group_id, std::function<void(const GroupMemberInfo&)> callback){
+        nlohmann::json data = {
+            {"group_id", group_id}
+        };
+        return callApiStream("/get_group_member_list", data, _typed(std::move(callback)));
+    }
+
     // ApiResult getGroupHonorInfo(uint64_t group_id, const std::string& type);
     ApiSet::ApiResult ApiSet::getGroupHonorInfo(uint64_t group_id, const std::string& type){
         nlohmann::json data = {
@@ -0,0 +1,142 @@
+#include "arena.hh"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace twobot {
+    namespace {
+        // 每个分配前面放一个头部标记来源，释放时不需要知道当前线程的arena，
+        // 头部大小等于对齐要求，保证返回的地址仍然按max_align_t对齐
+        constexpr std::size_t HEADER_SIZE = alignof(std::max_align_t);
+        enum : unsigned char { FROM_HEAP = 0, FROM_ARENA = 1 };
+
+        thread_local EventArena* t_arena = nullptr;
+
+        std::atomic<uint64_t> g_events{ 0 };
+        std::atomic<uint64_t> g_heap_allocs{ 0 };
+        std::atomic<uint64_t> g_arena_allocs{ 0 };
+
+        constexpr std::size_t LOCAL_CACHE_SIZE = 8;
+        constexpr std::size_t SHARED_POOL_SIZE = 256;
+
+        // 监听器在线程池中结束，arena通常在另一个线程上释放，所以先放回线程本地缓存，满了再放进共享池
+        struct LocalCache {
+            std::vector<EventArena*> arenas;
+            ~LocalCache() {
+                for (auto arena : arenas)
+                    delete arena;
+            }
+        };
+        thread_local LocalCache t_cache;
+
+        std::mutex g_pool_mtx;
+        std::vector<EventArena*> g_pool;
+
+        void _recycle(EventArena* arena) {
+            arena->reset();
+            if (t_cache.arenas.size() < LOCAL_CACHE_SIZE) {
+                t_cache.arenas.push_back(arena);
+                return;
+            }
+            {
+                std::lock_guard lock(g_pool_mtx);
+                if (g_pool.size() < SHARED_POOL_SIZE) {
+                    g_pool.push_back(arena);
+                    return;
+                }
+            }
+            delete arena;
+        }
+    }
+
+    EventArena::Ptr EventArena::acquire() {
+        EventArena* arena = nullptr;
+        if (!t_cache.arenas.empty()) {
+            arena = t_cache.arenas.back();
+            t_cache.arenas.pop_back();
+        }
+        else {
+            std::lock_guard lock(g_pool_mtx);
+            if (!g_pool.empty()) {
+                arena = g_pool.back();
+                g_pool.pop_back();
+            }
+        }
+        if (arena == nullptr)
+            arena = new EventArena;
+        return Ptr(arena, _recycle);
+    }
+
+    void* EventArena::allocate(std::size_t size) {
+        size = (size + HEADER_SIZE - 1) / HEADER_SIZE * HEADER_SIZE;
+        while (m_current < m_chunks.size()) {
+            auto& chunk = m_chunks[m_current];
+            if (chunk.size - m_used >= size) {
+                void* ptr = chunk.data.get() + m_used;
+                m_used += size;
+                return ptr;
+            }
+            ++m_current;
+            m_used = 0;
+        }
+        // 超大的节点单独占一块，块的大小按倍数增长
+        auto chunk_size = std::max(size, m_chunks.empty() ? CHUNK_SIZE : m_chunks.back().size * 2);
+        m_chunks.push_back({ std::unique_ptr<std::byte[]>(new std::byte[chunk_size]), chunk_size });
+        m_current = m_chunks.size() - 1;
+        m_used = size;
+        return m_chunks.back().data.get();
+    }
+
+    void EventArena::reset() {
+        // 只保留第一块，避免一个大事件让池里的内存一直膨胀
+        if (m_chunks.size() > 1)
+            m_chunks.resize(1);
+        m_current = 0;
+        m_used = 0;
+    }
+
+    ArenaScope::ArenaScope(EventArena* arena) : m_prev(t_arena) {
+        if (arena != nullptr)
+            t_arena = arena;
+    }
+
+    ArenaScope::~ArenaScope() {
+        t_arena = m_prev;
+    }
+
+    void countDecodedEvent() {
+        g_events.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    EventAllocStats getEventAllocStats() {
+        return {
+            g_events.load(std::memory_order_relaxed),
+            g_heap_allocs.load(std::memory_order_relaxed),
+            g_arena_allocs.load(std::memory_order_relaxed)
+        };
+    }
+
+    namespace _ {
+        void* eventAllocate(std::size_t size) {
+            unsigned char* ptr;
+            if (t_arena != nullptr) {
+                ptr = static_cast<unsigned char*>(t_arena->allocate(size + HEADER_SIZE));
+                *ptr = FROM_ARENA;
+                g_arena_allocs.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                ptr = static_cast<unsigned char*>(::operator new(size + HEADER_SIZE));
+                *ptr = FROM_HEAP;
+                g_heap_allocs.fetch_add(1, std::memory_order_relaxed);
+            }
+            return ptr + HEADER_SIZE;
+        }
+
+        void eventDeallocate(void* ptr) noexcept {
+            auto base = static_cast<unsigned char*>(ptr) - HEADER_SIZE;
+            // arena里的节点随arena整体回收
+            if (*base == FROM_HEAP)
+                ::operator delete(base);
+        }
+    }
+}
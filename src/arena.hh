@@ -0,0 +1,48 @@
+#pragma once
+#include "twobot.hh"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace twobot {
+    // 单个事件的单调内存池，只分配不释放，事件销毁后整体重置并回到池里复用
+    // 只在IO线程解码时分配，重置发生在所有引用都释放之后，所以不需要加锁
+    class EventArena {
+    public:
+        using Ptr = std::shared_ptr<EventArena>;
+
+        // 从池中取一个内存池，引用计数归零时自动重置并放回
+        static Ptr acquire();
+
+        void* allocate(std::size_t size);
+        void reset();
+
+    private:
+        static constexpr std::size_t CHUNK_SIZE = 16 * 1024;
+
+        struct Chunk {
+            std::unique_ptr<std::byte[]> data;
+            std::size_t size;
+        };
+
+        std::vector<Chunk> m_chunks;
+        std::size_t m_current = 0; // 正在分配的块
+        std::size_t m_used = 0;    // 当前块已用字节数
+    };
+
+    // 作用域内当前线程的EventJson分配走arena，arena为空时不改变分配方式
+    class ArenaScope {
+    public:
+        explicit ArenaScope(EventArena* arena);
+        ~ArenaScope();
+
+        ArenaScope(const ArenaScope&) = delete;
+        ArenaScope& operator=(const ArenaScope&) = delete;
+
+    private:
+        EventArena* m_prev;
+    };
+
+    // 统计解码的事件数，getEventAllocStats用它计算每个事件的分配次数
+    void countDecodedEvent();
+}
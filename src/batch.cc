@@ -0,0 +1,158 @@
+#include "twobot.hh"
+#include "context.hh"
+#include <exception>
+#include <mutex>
+
+namespace twobot {
+    namespace {
+        ApiSet::SyncResult _cancelled() {
+            return { false, { {"error", "cancelled"} } };
+        }
+
+        ApiSet::SyncResult _result_of(const std::shared_ptr<ApiSet::ApiResult::State>& state) {
+            try {
+                return state->take();
+            }
+            catch (const std::exception& e) {
+                return { false, { {"error", e.what()} } };
+            }
+        }
+
+        // 滑动窗口：每完成一个请求就补发下一个，直到所有目标都有结果
+        struct Batch : std::enable_shared_from_this<Batch> {
+            Batch(ApiSet api, std::vector<uint64_t> targets, ApiSet::BatchCall call, std::function<bool(uint64_t)> skip, std::shared_ptr<BotContext> ctx)
+                : api(std::move(api))
+                , targets(std::move(targets))
+                , call(std::move(call))
+                , skip(std::move(skip))
+                , ctx(std::move(ctx))
+                , remaining(this->targets.size())
+            {
+                report.items.resize(this->targets.size());
+            }
+
+            void launchNext() {
+                std::size_t index;
+                // 跳过的目标在这里直接结束，不占用发送配额；循环而不是递归，取消大批量时不会爆栈
+                while (true) {
+                    {
+                        std::lock_guard lock(mtx);
+                        if (next >= targets.size())
+                            return;
+                        index = next++;
+                    }
+                    if (!skip || !skip(targets[index]))
+                        break;
+                    if (record(index, _cancelled()))
+                        return;
+                }
+                ctx->runAt(ctx->outbound.reserve(), [self = shared_from_this(), index] {
+                    ApiSet::ApiResult result;
+                    try {
+                        result = self->call(self->api, self->targets[index]);
+                    }
+                    catch (const std::exception& e) {
+                        result = ApiSet::ApiResult::fromValue({ false, { {"error", e.what()} } });
+                    }
+                    result.onComplete([self, index](std::shared_ptr<ApiSet::ApiResult::State> state) {
+                        self->finish(index, _result_of(state));
+                    });
+                });
+            }
+
+            void finish(std::size_t index, ApiSet::SyncResult result) {
+                if (!record(index, std::move(result)))
+                    launchNext();
+            }
+
+            // 记下一个目标的结果，最后一个时完成整个批量调用并返回true
+            bool record(std::size_t index, ApiSet::SyncResult result) {
+                bool last;
+                {
+                    std::lock_guard lock(mtx);
+                    if (result.first)
+                        ++report.succeeded;
+                    else
+                        ++report.failed;
+                    report.items[index] = { targets[index], std::move(result) };
+                    last = --remaining == 0;
+                }
+                if (last)
+                    done->set(std::move(report));
+                return last;
+            }
+
+            ApiSet api;
+            std::vector<uint64_t> targets;
+            ApiSet::BatchCall call;
+            std::function<bool(uint64_t)> skip;
+            std::shared_ptr<BotContext> ctx;
+            std::shared_ptr<SharedState<ApiSet::BatchReport>> done = std::make_shared<SharedState<ApiSet::BatchReport>>();
+
+            std::mutex mtx;
+            std::size_t next = 0;
+            std::size_t remaining;
+            ApiSet::BatchReport report;
+        };
+    }
+
+    ApiSet::BatchResult ApiSet::callApiBatch(const std::vector<uint64_t>& targets, BatchCall call, BatchOptions options) {
+        // 批量调用需要每个目标的结果
+        ApiSet api = *this;
+        if (auto mode = std::get_if<AsyncMode>(&api.m_mode))
+            mode->needResp = true;
+
+        // 还没有启动时没有线程池，按顺序逐个调用
+        if (!m_ctx->executor) {
+            BatchReport report;
+            report.items.reserve(targets.size());
+            for (auto target : targets) {
+                SyncResult result;
+                if (options.skip && options.skip(target)) {
+                    result = _cancelled();
+                }
+                else {
+                    std::this_thread::sleep_until(m_ctx->outbound.reserve());
+                    try {
+                        result = call(api, target).get();
+                    }
+                    catch (const std::exception& e) {
+                        result = { false, { {"error", e.what()} } };
+                    }
+                }
+                result.first ? ++report.succeeded : ++report.failed;
+                report.items.push_back({ target, std::move(result) });
+            }
+            return BatchResult::fromValue(std::move(report));
+        }
+
+        auto batch = std::make_shared<Batch>(std::move(api), targets, std::move(call), std::move(options.skip), m_ctx);
+        batch->done->executor = m_ctx->laneExecutor(Lane::BACKGROUND);
+        BatchResult ret{ batch->done };
+        if (targets.empty()) {
+            batch->done->set({});
+            return ret;
+        }
+        for (std::size_t i = 0; i < std::max<std::size_t>(options.window, 1); ++i)
+            batch->launchNext();
+        return ret;
+    }
+
+    ApiSet::BatchResult ApiSet::setGroupKickBatch(uint64_t group_id, const std::vector<uint64_t>& user_ids, bool reject_add_request, BatchOptions options) {
+        return callApiBatch(user_ids, [group_id, reject_add_request](ApiSet& api, uint64_t user_id) {
+            return api.setGroupKick(group_id, user_id, reject_add_request);
+        }, options);
+    }
+
+    ApiSet::BatchResult ApiSet::setGroupBanBatch(uint64_t group_id, const std::vector<uint64_t>& user_ids, uint32_t duration, BatchOptions options) {
+        return callApiBatch(user_ids, [group_id, duration](ApiSet& api, uint64_t user_id) {
+            return api.setGroupBan(group_id, user_id, duration);
+        }, options);
+    }
+
+    ApiSet::BatchResult ApiSet::deleteMsgBatch(const std::vector<uint32_t>& message_ids, BatchOptions options) {
+        return callApiBatch({ message_ids.begin(), message_ids.end() }, [](ApiSet& api, uint64_t message_id) {
+            return api.deleteMsg(static_cast<uint32_t>(message_id));
+        }, options);
+    }
+}
@@ -0,0 +1,92 @@
+#include "twobot.hh"
+#include <cstdio>
+#include <fstream>
+#include <unordered_set>
+
+namespace twobot {
+    namespace {
+        std::unordered_set<uint64_t> _load_checkpoint(const std::string& path) {
+            std::unordered_set<uint64_t> done;
+            std::ifstream file(path);
+            uint64_t group_id;
+            while (file >> group_id)
+                done.insert(group_id);
+            return done;
+        }
+    }
+
+    ApiSet::Broadcast ApiSet::broadcastGroupMsg(const std::vector<uint64_t>& group_ids, const std::string& message, bool auto_escape, BroadcastOptions options) {
+        std::vector<uint64_t> targets;
+        if (options.checkpoint.empty()) {
+            targets = group_ids;
+        }
+        else {
+            auto done = _load_checkpoint(options.checkpoint);
+            for (auto group_id : group_ids)
+                if (!done.count(group_id))
+                    targets.push_back(group_id);
+        }
+
+        // params的序列化只做一次，group_id放在最后，每个群只需要拼接数字
+        nlohmann::json params = {
+            {"message", message},
+            {"auto_escape", auto_escape}
+        };
+        auto head = params.dump();
+        head.pop_back();
+        head += ",\"group_id\":";
+
+        auto control = std::make_shared<BroadcastControl>();
+        control->m_total = targets.size();
+        auto checkpoint = std::make_shared<std::ofstream>();
+        if (!options.checkpoint.empty())
+            checkpoint->open(options.checkpoint, std::ios::app);
+
+        auto report = [control, checkpoint, on_progress = options.on_progress](uint64_t group_id, SyncResult result) {
+            if (result.first && checkpoint->is_open()) {
+                std::lock_guard lock(control->m_checkpointMtx);
+                *checkpoint << group_id << std::endl;
+            }
+            ++(result.first ? control->m_succeeded : control->m_failed);
+            ++control->m_done;
+            if (on_progress)
+                on_progress(control->progress());
+            return result;
+        };
+        // 取消后剩下的群在占用发送配额之前就结束，同样计入进度
+        auto skip = [control, report](uint64_t group_id) {
+            if (!control->cancelled())
+                return false;
+            report(group_id, { false, { {"error", "cancelled"} } });
+            return true;
+        };
+        auto call = [control, head = std::move(head), report](ApiSet& api, uint64_t group_id) {
+            // 等待发送配额期间被取消
+            if (control->cancelled())
+                return ApiResult::fromValue(report(group_id, { false, { {"error", "cancelled"} } }));
+            auto params = head + std::to_string(group_id) + "}";
+            auto result = api.callApiRaw("/send_group_msg", params);
+            // 同步模式下已经有结果，直接记录，避免再经过一次线程池
+            if (result.ready())
+                return ApiResult::fromValue(report(group_id, result.get()));
+            return result.then([report, group_id](SyncResult result) {
+                return report(group_id, std::move(result));
+            });
+        };
+
+        auto result = callApiBatch(targets, std::move(call), { options.window, std::move(skip) });
+        if (options.checkpoint.empty())
+            return { std::move(control), std::move(result) };
+
+        // 全部成功后断点文件就没有用了，有失败或被取消时保留，下次只补发剩下的群
+        auto finished = result.then([control, checkpoint, path = options.checkpoint](BatchReport report) {
+            if (report.failed == 0 && !control->cancelled()) {
+                std::lock_guard lock(control->m_checkpointMtx);
+                checkpoint->close();
+                std::remove(path.c_str());
+            }
+            return report;
+        });
+        return { std::move(control), std::move(finished) };
+    }
+}
@@ -0,0 +1,675 @@
+#include "bus.hh"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace twobot {
+    namespace {
+        constexpr char MAGIC[8] = { 'T', 'W', 'O', 'B', 'B', 'U', 'S', '1' };
+        constexpr uint32_t VERSION = 1;
+        constexpr int64_t STALE_MS = 30000; // 消费者超过这么久没有心跳，视为已经退出
+
+        enum SlotState : uint32_t {
+            FREE = 0,
+            CLAIMING = 1, // 正在写入订阅
+            ACTIVE = 2,
+        };
+
+        struct Slot {
+            std::atomic<uint32_t> state;
+            uint32_t subscription_count; // 为0表示订阅所有事件
+            std::atomic<uint64_t> generation; // 每次被占用时加一，消费者据此发现槽位被回收
+            std::atomic<int64_t> heartbeat;   // 毫秒时间戳
+            uint64_t subscriptions[bus::MAX_SUBSCRIPTIONS];
+            alignas(64) std::atomic<uint64_t> action_write; // 消费者写
+            alignas(64) std::atomic<uint64_t> action_read;  // 机器人读
+        };
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            std::atomic<uint32_t> retired; // 段已经被布局不同的新段取代
+            uint64_t capacity;        // 事件环的字节数
+            uint64_t action_capacity; // 每个调用环的字节数
+            alignas(64) std::atomic<uint64_t> reserve; // 写者将要写到的位置
+            alignas(64) std::atomic<uint64_t> write;   // 已经写完的位置
+            Slot slots[bus::MAX_SLOTS];
+        };
+
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "event bus needs lock-free 64-bit atomics");
+
+        enum RecordKind : uint16_t {
+            PADDING = 0, // 填充到环尾
+            DATA = 1,
+        };
+
+        // 事件记录，之后依次是post_type、sub_type和MessagePack编码的事件，整条记录按8字节对齐
+        struct EventRecord {
+            uint64_t pos;  // 记录的起始位置，读者据此确认没有被覆盖
+            uint32_t size; // 整条记录的字节数
+            uint16_t kind;
+            uint8_t post_size;
+            uint8_t sub_size;
+            uint64_t self_id;
+            int64_t time;
+            uint32_t body_size;
+            uint32_t reserved;
+        };
+
+        // 调用记录，之后依次是api名和MessagePack编码的参数
+        struct ActionRecord {
+            uint32_t size;
+            uint16_t kind;
+            uint16_t name_size;
+            uint64_t self_id;
+            uint32_t body_size;
+            uint32_t reserved;
+        };
+
+        uint64_t _align(uint64_t size) {
+            return (size + 7) & ~uint64_t(7);
+        }
+
+        std::size_t _header_size() {
+            return (sizeof(Header) + 63) & ~std::size_t(63);
+        }
+
+        std::size_t _layout_size(uint64_t capacity, uint64_t action_capacity) {
+            return _header_size() + capacity + action_capacity * bus::MAX_SLOTS;
+        }
+
+        int64_t _now_ms() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        // 空闲时先让出时间片，之后逐渐拉长睡眠
+        void _backoff(uint32_t& idle) {
+            if (++idle < 64)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(idle < 1024 ? 50 : 1000));
+        }
+    }
+
+    namespace bus {
+        uint64_t typeHash(std::string_view post_type, std::string_view sub_type) {
+            uint64_t hash = 14695981039346656037ull;
+            auto feed = [&hash](std::string_view text) {
+                for (unsigned char c : text) {
+                    hash ^= c;
+                    hash *= 1099511628211ull;
+                }
+            };
+            feed(post_type);
+            feed(std::string_view("\0", 1));
+            feed(sub_type);
+            return hash;
+        }
+    }
+
+    // 命名的共享内存，POSIX下为shm_open，Windows下为页面文件支持的命名映射
+    class SharedMemory {
+    public:
+        // 打开已有的段，不存在时返回nullptr
+        static std::unique_ptr<SharedMemory> open(const std::string& name) {
+            std::unique_ptr<SharedMemory> memory(new SharedMemory);
+#ifdef _WIN32
+            memory->m_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, _path(name).c_str());
+            if (memory->m_mapping == nullptr)
+                return nullptr;
+            memory->m_data = static_cast<char*>(MapViewOfFile(memory->m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+            if (memory->m_data == nullptr)
+                throw std::runtime_error("cannot map shared memory " + name);
+            MEMORY_BASIC_INFORMATION info{};
+            VirtualQuery(memory->m_data, &info, sizeof(info));
+            memory->m_size = info.RegionSize;
+#else
+            auto fd = shm_open(_path(name).c_str(), O_RDWR, 0600);
+            if (fd < 0)
+                return nullptr;
+            struct stat st {};
+            fstat(fd, &st);
+            memory->m_size = static_cast<std::size_t>(st.st_size);
+            memory->map(fd, name);
+#endif
+            return memory;
+        }
+
+        // 创建新的段，内容为零
+        static std::unique_ptr<SharedMemory> create(const std::string& name, std::size_t size) {
+            std::unique_ptr<SharedMemory> memory(new SharedMemory);
+            memory->m_size = size;
+#ifdef _WIN32
+            LARGE_INTEGER length;
+            length.QuadPart = static_cast<LONGLONG>(size);
+            memory->m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, length.HighPart, length.LowPart, _path(name).c_str());
+            if (memory->m_mapping == nullptr)
+                throw std::runtime_error("cannot create shared memory " + name);
+            // 命名映射在所有句柄关闭前不能删除，仍有消费者持有旧段时无法换成新的布局
+            if (GetLastError() == ERROR_ALREADY_EXISTS)
+                throw std::runtime_error("shared memory " + name + " is still in use with another layout");
+            memory->m_data = static_cast<char*>(MapViewOfFile(memory->m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+            if (memory->m_data == nullptr)
+                throw std::runtime_error("cannot map shared memory " + name);
+#else
+            auto fd = shm_open(_path(name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (fd < 0)
+                throw std::runtime_error("cannot create shared memory " + name);
+            if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+                ::close(fd);
+                throw std::runtime_error("cannot extend shared memory " + name);
+            }
+            memory->map(fd, name);
+#endif
+            return memory;
+        }
+
+        // 取得段的写者锁，已经被其他进程持有时返回false；锁随进程退出自动释放，不会因为崩溃残留
+        bool lock(const std::string& name) {
+#ifdef _WIN32
+            m_writer = CreateMutexA(nullptr, FALSE, (_path(name) + ".writer").c_str());
+            if (m_writer == nullptr)
+                throw std::runtime_error("cannot create writer lock of shared memory " + name);
+            // 上一个写者没有释放就退出时为WAIT_ABANDONED，可以直接接管
+            auto result = WaitForSingleObject(m_writer, 0);
+            return result == WAIT_OBJECT_0 || result == WAIT_ABANDONED;
+#else
+            if (flock(m_fd, LOCK_EX | LOCK_NB) == 0)
+                return true;
+            if (errno == EWOULDBLOCK)
+                return false;
+            throw std::runtime_error("cannot lock shared memory " + name);
+#endif
+        }
+
+        // 删除名字，已经映射的进程不受影响
+        static void remove(const std::string& name) {
+#ifndef _WIN32
+            shm_unlink(_path(name).c_str());
+#endif
+        }
+
+        ~SharedMemory() {
+#ifdef _WIN32
+            if (m_data != nullptr)
+                UnmapViewOfFile(m_data);
+            if (m_mapping != nullptr)
+                CloseHandle(m_mapping);
+            if (m_writer != nullptr) {
+                ReleaseMutex(m_writer);
+                CloseHandle(m_writer);
+            }
+#else
+            if (m_data != nullptr)
+                munmap(m_data, m_size);
+            if (m_fd >= 0)
+                ::close(m_fd);
+#endif
+        }
+
+        char* data() const { return m_data; }
+        std::size_t size() const { return m_size; }
+
+    private:
+        SharedMemory() = default;
+
+        static std::string _path(const std::string& name) {
+#ifdef _WIN32
+            return "Local\\twobot." + name;
+#else
+            return "/twobot." + name;
+#endif
+        }
+
+#ifndef _WIN32
+        // 描述符保留到析构，写者锁加在它上面
+        void map(int fd, const std::string& name) {
+            m_fd = fd;
+            auto data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED)
+                throw std::runtime_error("cannot map shared memory " + name);
+            m_data = static_cast<char*>(data);
+        }
+#endif
+
+#ifdef _WIN32
+        HANDLE m_mapping = nullptr;
+        HANDLE m_writer = nullptr;
+#else
+        int m_fd = -1;
+#endif
+        char* m_data = nullptr;
+        std::size_t m_size = 0;
+    };
+
+    namespace {
+        Header* _header(const SharedMemory& memory) {
+            return reinterpret_cast<Header*>(memory.data());
+        }
+
+        char* _events(const SharedMemory& memory) {
+            return memory.data() + _header_size();
+        }
+
+        char* _actions(const SharedMemory& memory, std::size_t slot) {
+            auto* header = _header(memory);
+            return _events(memory) + header->capacity + header->action_capacity * slot;
+        }
+
+        bool _compatible(const SharedMemory& memory, uint64_t capacity, uint64_t action_capacity) {
+            if (memory.size() < sizeof(Header))
+                return false;
+            auto* header = _header(memory);
+            return std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0
+                && header->version == VERSION
+                && header->capacity == capacity
+                && header->action_capacity == action_capacity
+                && memory.size() >= _layout_size(capacity, action_capacity);
+        }
+    }
+
+    EventBus::EventBus(const EventBusConfig& config) {
+        uint64_t capacity = std::bit_ceil(std::max<std::size_t>(config.capacity, 64 * 1024));
+        uint64_t action_capacity = std::bit_ceil(std::max<std::size_t>(config.action_capacity, 4096));
+
+        // 事件环只能有一个写者，两个机器人进程配置了同名的总线时后启动的一方失败
+        auto busy = [&config]() {
+            return std::runtime_error("event bus " + config.name + " is already written by another process");
+        };
+
+        // 布局相同时沿用上次的段，已经连接的消费者不受机器人重启影响
+        auto retired = [this]() {
+            return m_memory->size() >= sizeof(Header) && _header(*m_memory)->retired.load(std::memory_order_acquire) != 0;
+        };
+        m_memory = SharedMemory::open(config.name);
+        if (m_memory) {
+            if (!m_memory->lock(config.name))
+                throw busy();
+            // 上一个写者在打开和加锁之间把它换成了新段，重新打开一次；仍是退役的段说明它在删除前退出了，按不兼容处理
+            if (retired()) {
+                m_memory = SharedMemory::open(config.name);
+                if (m_memory && !m_memory->lock(config.name))
+                    throw busy();
+            }
+        }
+        if (m_memory && _compatible(*m_memory, capacity, action_capacity)) {
+            auto* header = _header(*m_memory);
+            // 上次退出时可能正在写，公布的位置回退到已经写完的位置
+            header->reserve.store(header->write.load(std::memory_order_acquire), std::memory_order_release);
+            return;
+        }
+        if (m_memory) {
+            if (m_memory->size() >= sizeof(Header) && std::memcmp(_header(*m_memory)->magic, MAGIC, sizeof(MAGIC)) == 0)
+                _header(*m_memory)->retired.store(1, std::memory_order_release);
+            m_memory.reset();
+            SharedMemory::remove(config.name);
+        }
+        try {
+            m_memory = SharedMemory::create(config.name, _layout_size(capacity, action_capacity));
+        }
+        catch (const std::runtime_error&) {
+            // 同时启动的另一个写者抢先创建了段
+            if (SharedMemory::open(config.name))
+                throw busy();
+            throw;
+        }
+        if (!m_memory->lock(config.name))
+            throw busy();
+        auto* header = _header(*m_memory);
+        header->version = VERSION;
+        header->capacity = capacity;
+        header->action_capacity = action_capacity;
+        // 魔数最后写入，消费者看到魔数时其余字段已经就绪
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(header->magic, MAGIC, sizeof(MAGIC));
+    }
+
+    EventBus::~EventBus() {
+        stop();
+    }
+
+    bool EventBus::subscribed(const EventType& type) const {
+        auto* header = _header(*m_memory);
+        auto hash = bus::typeHash(type.post_type, type.sub_type);
+        auto now = _now_ms();
+        for (auto& slot : header->slots) {
+            if (slot.state.load(std::memory_order_acquire) != ACTIVE)
+                continue;
+            if (now - slot.heartbeat.load(std::memory_order_relaxed) > STALE_MS)
+                continue;
+            auto count = std::min<std::size_t>(slot.subscription_count, bus::MAX_SUBSCRIPTIONS);
+            if (count == 0 || std::find(slot.subscriptions, slot.subscriptions + count, hash) != slot.subscriptions + count)
+                return true;
+        }
+        return false;
+    }
+
+    bool EventBus::publish(const EventType& type, uint64_t self_id, int64_t time, const std::vector<uint8_t>& body) {
+        auto* header = _header(*m_memory);
+        auto* ring = _events(*m_memory);
+        auto capacity = header->capacity;
+        if (type.post_type.size() > UINT8_MAX || type.sub_type.size() > UINT8_MAX)
+            return false;
+        auto size = _align(sizeof(EventRecord) + type.post_type.size() + type.sub_type.size() + body.size());
+        if (size > capacity / 2)
+            return false;
+
+        std::lock_guard lock(m_writeMtx);
+        auto pos = header->write.load(std::memory_order_relaxed);
+        auto offset = pos & (capacity - 1);
+        if (capacity - offset < size) {
+            // 剩余的空间放不下，填充到环尾；连记录头都放不下时读者自行跳过
+            auto padding = capacity - offset;
+            header->reserve.store(pos + padding, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            if (padding >= sizeof(EventRecord)) {
+                EventRecord record{};
+                record.pos = pos;
+                record.size = static_cast<uint32_t>(padding);
+                record.kind = PADDING;
+                std::memcpy(ring + offset, &record, sizeof(record));
+            }
+            pos += padding;
+            offset = 0;
+            header->write.store(pos, std::memory_order_release);
+        }
+
+        // 先公布将要覆盖的范围，再写入数据
+        header->reserve.store(pos + size, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        EventRecord record{};
+        record.pos = pos;
+        record.size = static_cast<uint32_t>(size);
+        record.kind = DATA;
+        record.post_size = static_cast<uint8_t>(type.post_type.size());
+        record.sub_size = static_cast<uint8_t>(type.sub_type.size());
+        record.self_id = self_id;
+        record.time = time;
+        record.body_size = static_cast<uint32_t>(body.size());
+        auto* out = ring + offset;
+        std::memcpy(out, &record, sizeof(record));
+        out += sizeof(record);
+        std::memcpy(out, type.post_type.data(), type.post_type.size());
+        out += type.post_type.size();
+        std::memcpy(out, type.sub_type.data(), type.sub_type.size());
+        out += type.sub_type.size();
+        std::memcpy(out, body.data(), body.size());
+        header->write.store(pos + size, std::memory_order_release);
+        return true;
+    }
+
+    void EventBus::start(ActionCallback callback) {
+        if (m_running.exchange(true))
+            return;
+        m_callback = std::move(callback);
+        m_poller = std::thread([this] { poll(); });
+    }
+
+    void EventBus::stop() {
+        m_running = false;
+        if (m_poller.joinable())
+            m_poller.join();
+    }
+
+    void EventBus::poll() {
+        auto* header = _header(*m_memory);
+        auto capacity = header->action_capacity;
+        uint32_t idle = 0;
+        while (m_running) {
+            bool busy = false;
+            for (std::size_t i = 0; i < bus::MAX_SLOTS; ++i) {
+                auto& slot = header->slots[i];
+                // 槽位被释放或回收后，环中剩下的调用仍然执行
+                auto write = slot.action_write.load(std::memory_order_acquire);
+                auto read = slot.action_read.load(std::memory_order_relaxed);
+                if (read == write)
+                    continue;
+                busy = true;
+                auto* ring = _actions(*m_memory, i);
+                while (read != write) {
+                    auto offset = read & (capacity - 1);
+                    if (capacity - offset < sizeof(ActionRecord)) {
+                        read += capacity - offset;
+                        continue;
+                    }
+                    ActionRecord record;
+                    std::memcpy(&record, ring + offset, sizeof(record));
+                    if (record.size < sizeof(ActionRecord) || record.size > capacity - offset
+                        || record.name_size + uint64_t(record.body_size) > record.size - sizeof(ActionRecord)) {
+                        std::cerr << "Event Bus: corrupted action ring in slot " << i << ", dropping pending actions" << std::endl;
+                        read = write;
+                        break;
+                    }
+                    if (record.kind == DATA) {
+                        auto* name = ring + offset + sizeof(ActionRecord);
+                        auto* body = reinterpret_cast<const uint8_t*>(name + record.name_size);
+                        auto params = nlohmann::json::from_msgpack(body, body + record.body_size, true, false);
+                        if (!params.is_discarded()) {
+                            try {
+                                m_callback(record.self_id, std::string_view(name, record.name_size), std::move(params));
+                            }
+                            catch (const std::exception& e) {
+                                std::cerr << "Event Bus: action failed: " << e.what() << std::endl;
+                            }
+                        }
+                    }
+                    read += record.size;
+                    slot.action_read.store(read, std::memory_order_release);
+                }
+                slot.action_read.store(read, std::memory_order_release);
+            }
+            if (busy)
+                idle = 0;
+            else
+                _backoff(idle);
+        }
+    }
+
+    BusConsumer::BusConsumer(const std::string& name, std::vector<EventType> subscriptions) {
+        if (subscriptions.size() > bus::MAX_SUBSCRIPTIONS)
+            throw std::runtime_error("too many event bus subscriptions");
+        for (auto& type : subscriptions)
+            m_subscriptions.emplace_back(type.post_type, type.sub_type);
+        m_memory = SharedMemory::open(name);
+        if (!m_memory)
+            throw std::runtime_error("event bus " + name + " does not exist");
+        auto* header = _header(*m_memory);
+        if (m_memory->size() < sizeof(Header) || std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::runtime_error("event bus " + name + " is not initialized");
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!_compatible(*m_memory, header->capacity, header->action_capacity))
+            throw std::runtime_error("event bus " + name + " has an incompatible layout");
+        claim();
+    }
+
+    BusConsumer::~BusConsumer() {
+        if (owned())
+            _header(*m_memory)->slots[m_slot].state.store(FREE, std::memory_order_release);
+    }
+
+    void BusConsumer::claim() {
+        auto* header = _header(*m_memory);
+        auto now = _now_ms();
+        for (std::size_t i = 0; i < bus::MAX_SLOTS; ++i) {
+            auto& slot = header->slots[i];
+            auto state = slot.state.load(std::memory_order_acquire);
+            bool stale = state == ACTIVE && now - slot.heartbeat.load(std::memory_order_relaxed) > STALE_MS;
+            if (state != FREE && !stale)
+                continue;
+            if (!slot.state.compare_exchange_strong(state, CLAIMING, std::memory_order_acq_rel))
+                continue;
+            m_generation = slot.generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+            slot.heartbeat.store(now, std::memory_order_relaxed);
+            slot.subscription_count = static_cast<uint32_t>(m_subscriptions.size());
+            for (std::size_t j = 0; j < m_subscriptions.size(); ++j)
+                slot.subscriptions[j] = bus::typeHash(m_subscriptions[j].first, m_subscriptions[j].second);
+            slot.state.store(ACTIVE, std::memory_order_release);
+            m_slot = i;
+            m_cursor = header->write.load(std::memory_order_acquire);
+            return;
+        }
+        throw std::runtime_error("no free slot on event bus");
+    }
+
+    bool BusConsumer::owned() const {
+        auto& slot = _header(*m_memory)->slots[m_slot];
+        return slot.generation.load(std::memory_order_acquire) == m_generation
+            && slot.state.load(std::memory_order_acquire) == ACTIVE;
+    }
+
+    bool BusConsumer::wanted(std::string_view post_type, std::string_view sub_type) const {
+        if (m_subscriptions.empty())
+            return true;
+        return std::any_of(m_subscriptions.begin(), m_subscriptions.end(), [&](const auto& type) {
+            return type.first == post_type && type.second == sub_type;
+        });
+    }
+
+    bool BusConsumer::read(Event& event) {
+        auto* header = _header(*m_memory);
+        auto* ring = _events(*m_memory);
+        auto capacity = header->capacity;
+        auto write = header->write.load(std::memory_order_acquire);
+        // 复制之后确认写者没有越过这条记录，否则从最新位置重新开始
+        auto overwritten = [&] {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->reserve.load(std::memory_order_relaxed) <= m_cursor + capacity)
+                return false;
+            ++m_overruns;
+            m_cursor = header->write.load(std::memory_order_acquire);
+            return true;
+        };
+        while (m_cursor != write) {
+            if (write - m_cursor > capacity) {
+                ++m_overruns;
+                m_cursor = write;
+                return false;
+            }
+            auto offset = m_cursor & (capacity - 1);
+            if (capacity - offset < sizeof(EventRecord)) {
+                m_cursor += capacity - offset;
+                continue;
+            }
+            EventRecord record;
+            std::memcpy(&record, ring + offset, sizeof(record));
+            if (overwritten())
+                return false;
+            if (record.pos != m_cursor || record.size < sizeof(EventRecord) || record.size > capacity - offset
+                || record.post_size + record.sub_size + uint64_t(record.body_size) > record.size - sizeof(EventRecord)) {
+                ++m_overruns;
+                m_cursor = write;
+                return false;
+            }
+            auto next = m_cursor + record.size;
+            if (record.kind != DATA) {
+                m_cursor = next;
+                continue;
+            }
+            auto* payload = ring + offset + sizeof(EventRecord);
+            std::string_view post_type(payload, record.post_size);
+            std::string_view sub_type(payload + record.post_size, record.sub_size);
+            // 不订阅的事件只看类型，不复制负载
+            if (!wanted(post_type, sub_type)) {
+                if (overwritten())
+                    return false;
+                m_cursor = next;
+                continue;
+            }
+            auto size = record.post_size + record.sub_size + record.body_size;
+            m_buffer.assign(payload, payload + size);
+            if (overwritten())
+                return false;
+            m_cursor = next;
+
+            auto* body = m_buffer.data() + record.post_size + record.sub_size;
+            event.data = nlohmann::json::from_msgpack(body, body + record.body_size, true, false);
+            if (event.data.is_discarded())
+                continue;
+            event.post_type.assign(reinterpret_cast<const char*>(m_buffer.data()), record.post_size);
+            event.sub_type.assign(reinterpret_cast<const char*>(m_buffer.data()) + record.post_size, record.sub_size);
+            event.self_id = record.self_id;
+            event.time = record.time;
+            return true;
+        }
+        return false;
+    }
+
+    std::optional<BusConsumer::Event> BusConsumer::next(std::chrono::milliseconds timeout) {
+        auto* header = _header(*m_memory);
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        uint32_t idle = 0;
+        Event event;
+        while (true) {
+            if (header->retired.load(std::memory_order_acquire))
+                throw std::runtime_error("event bus was recreated with another layout");
+            // 长时间没有取事件的槽位可能被别的消费者回收
+            if (!owned())
+                claim();
+            header->slots[m_slot].heartbeat.store(_now_ms(), std::memory_order_relaxed);
+            if (read(event))
+                return event;
+            if (std::chrono::steady_clock::now() >= deadline)
+                return std::nullopt;
+            _backoff(idle);
+        }
+    }
+
+    bool BusConsumer::submit(uint64_t self_id, std::string_view api_name, const nlohmann::json& params) {
+        if (api_name.size() > UINT16_MAX)
+            return false;
+        if (!owned())
+            claim();
+        auto* header = _header(*m_memory);
+        auto& slot = header->slots[m_slot];
+        auto* ring = _actions(*m_memory, m_slot);
+        auto capacity = header->action_capacity;
+        auto body = nlohmann::json::to_msgpack(params);
+        auto size = _align(sizeof(ActionRecord) + api_name.size() + body.size());
+        if (size > capacity / 2)
+            return false;
+
+        auto write = slot.action_write.load(std::memory_order_relaxed);
+        auto read = slot.action_read.load(std::memory_order_acquire);
+        auto offset = write & (capacity - 1);
+        auto padding = capacity - offset < size ? capacity - offset : 0;
+        if (write + padding + size - read > capacity)
+            return false;
+        if (padding > 0) {
+            if (padding >= sizeof(ActionRecord)) {
+                ActionRecord record{};
+                record.size = static_cast<uint32_t>(padding);
+                record.kind = PADDING;
+                std::memcpy(ring + offset, &record, sizeof(record));
+            }
+            write += padding;
+            offset = 0;
+        }
+        ActionRecord record{};
+        record.size = static_cast<uint32_t>(size);
+        record.kind = DATA;
+        record.name_size = static_cast<uint16_t>(api_name.size());
+        record.self_id = self_id;
+        record.body_size = static_cast<uint32_t>(body.size());
+        auto* out = ring + offset;
+        std::memcpy(out, &record, sizeof(record));
+        out += sizeof(record);
+        std::memcpy(out, api_name.data(), api_name.size());
+        out += api_name.size();
+        std::memcpy(out, body.data(), body.size());
+        slot.action_write.store(write + size, std::memory_order_release);
+        return true;
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include "twobot.hh"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace twobot {
+    class SharedMemory;
+
+    // 共享内存事件总线，机器人进程把解码后的事件以紧凑的二进制格式写入环形缓冲区，其他进程中的BusConsumer订阅读取
+    // 布局：头部和消费者槽位，之后是事件环，最后是每个槽位各自的调用环
+    // 事件环只有一个写者，读者各自维护读位置，写者从不等待读者，落后超过一圈的读者丢弃未读的事件后从最新位置继续；
+    // 写者在写入前先公布将要覆盖到的位置，读者复制记录后据此校验记录是否在复制期间被覆盖(类似seqlock)
+    // 调用环是消费者到机器人的单读单写队列，满时提交失败
+    // 共享内存在进程退出后保留，机器人重启后继续使用同一个段，消费者不需要重新连接
+    namespace bus {
+        inline constexpr std::size_t MAX_SLOTS = 16;
+        inline constexpr std::size_t MAX_SUBSCRIPTIONS = 32;
+
+        // 订阅按(post_type, sub_type)的哈希匹配，记录中带有原始字符串，消费者读出后再精确比较
+        uint64_t typeHash(std::string_view post_type, std::string_view sub_type);
+    }
+
+    // 机器人进程一侧，写事件、读调用
+    class EventBus {
+    public:
+        using ActionCallback = std::function<void(uint64_t self_id, std::string_view api_name, nlohmann::json params)>;
+
+        // 独占同名总线的写者锁，已经有其他写者(包括本进程中的另一个EventBus)时抛出std::runtime_error
+        explicit EventBus(const EventBusConfig& config);
+        ~EventBus();
+
+        EventBus(const EventBus&) = delete;
+        EventBus& operator=(const EventBus&) = delete;
+
+        // 是否有存活的消费者订阅了这类事件，没有时不必序列化
+        bool subscribed(const EventType& type) const;
+        // body为事件的MessagePack编码，超过事件环一半大小的事件丢弃，返回是否写入
+        bool publish(const EventType& type, uint64_t self_id, int64_t time, const std::vector<uint8_t>& body);
+
+        // 启动读取调用环的线程，按每个消费者提交的顺序回调
+        void start(ActionCallback callback);
+        void stop();
+
+    private:
+        void poll();
+
+        std::unique_ptr<SharedMemory> m_memory;
+        std::mutex m_writeMtx;
+        ActionCallback m_callback{};
+        std::atomic<bool> m_running{ false };
+        std::thread m_poller;
+    };
+
+    // 消费者进程一侧，只依赖TwoBot-bus库，不需要连接OneBot
+    class BusConsumer {
+    public:
+        struct Event {
+            std::string post_type;
+            std::string sub_type;
+            uint64_t self_id;
+            int64_t time;
+            nlohmann::json data; // 完整的事件json
+        };
+
+        // 连接名为name的总线并占用一个槽位，subscriptions为空表示订阅所有事件；
+        // 总线不存在或槽位已满时抛出std::runtime_error
+        BusConsumer(const std::string& name, std::vector<EventType> subscriptions);
+        ~BusConsumer();
+
+        BusConsumer(const BusConsumer&) = delete;
+        BusConsumer& operator=(const BusConsumer&) = delete;
+
+        // 取出下一条订阅的事件，timeout内没有时返回nullopt；只接收连接之后发布的事件
+        std::optional<Event> next(std::chrono::milliseconds timeout);
+        // 提交一次API调用，由机器人以异步模式发出，不等待响应；调用环满时返回false
+        bool submit(uint64_t self_id, std::string_view api_name, const nlohmann::json& params);
+
+        // 因为落后超过一圈而丢弃事件的次数
+        uint64_t overruns() const { return m_overruns; }
+
+    private:
+        // 读出下一条订阅的事件，已经读到最新时返回false
+        bool read(Event& event);
+        bool wanted(std::string_view post_type, std::string_view sub_type) const;
+        // 占用一个空闲的槽位，或者心跳已经过期的槽位
+        void claim();
+        bool owned() const;
+
+        std::unique_ptr<SharedMemory> m_memory;
+        std::vector<std::pair<std::string, std::string>> m_subscriptions;
+        std::size_t m_slot = 0;
+        uint64_t m_generation = 0;
+        uint64_t m_cursor = 0;
+        uint64_t m_overruns = 0;
+        std::vector<uint8_t> m_buffer;
+    };
+}
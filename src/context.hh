@@ -0,0 +1,163 @@
+#pragma once
+#include "twobot.hh"
+#include "session.hh"
+#include "transport.hh"
+#include "forward.hh"
+#include "runtime.hh"
+#include "timer.hh"
+#include "fair.hh"
+#include "trace.hh"
+#include "watchdog.hh"
+#include "dedup.hh"
+#include "msgstore.hh"
+#include "recall.hh"
+#include "search.hh"
+#include "bus.hh"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <shared_mutex>
+#include <thread>
+#include <brynet/net/wrapper/HttpServiceBuilder.hpp>
+
+namespace twobot {
+    // 当前线程正在执行的派发通道，由BotContext::LaneScope设置
+    inline thread_local Lane t_lane = Lane::LIFECYCLE;
+
+    // 机器人实例与ApiSet共享的运行时状态，ApiSet和IO回调可能比BotInstance活得更久，所以用shared_ptr持有
+    struct BotContext {
+        explicit BotContext(const Config& config, std::shared_ptr<Runtime> runtime)
+            : runtime(std::move(runtime))
+            , sessions(config.send_queue_size, config.send_queue_timeout, pending)
+            , http(config.host, config.api_port)
+            , outbound(config.api_rate_limit)
+        {
+            if (config.timer_store.has_value())
+                timer_store = std::make_unique<TimerStore>(*config.timer_store);
+            if (config.trace.has_value())
+                tracer = std::make_shared<Tracer>(*config.trace);
+            if (config.watchdog.has_value())
+                watchdog = std::make_unique<Watchdog>(*config.watchdog);
+            if (config.dedup.has_value())
+                dedup = std::make_unique<EventDedup>(*config.dedup);
+            if (config.message_store.has_value())
+                messages = std::make_unique<MessageStore>(*config.message_store);
+            if (config.recall_cache.has_value())
+                recalls = std::make_unique<RecallCache>(*config.recall_cache);
+            if (config.event_bus.has_value())
+                bus = std::make_unique<EventBus>(*config.event_bus);
+            if (config.search.has_value())
+            {
+                search = std::make_unique<SearchIndex>(*config.search);
+                // 索引只在内存中，从消息存储重建
+                if (messages)
+                {
+                    messages->scan([this](const StoredMessage& message) {
+                        auto event = EventJson::parse(message.raw, nullptr, false);
+                        if (event.is_object())
+                            search->add(event);
+                    });
+                }
+            }
+
+        }
+
+        std::shared_ptr<Runtime> runtime;
+        Executor executor{}; // LIFECYCLE通道，第一次startAsync()之后有效，投递的任务计入tasks
+        std::array<Executor, 4> lanes{}; // 各派发通道的执行器，下标为Lane，没有配置通道时都进入同一个线程池
+
+        std::array<std::shared_ptr<FairScheduler>, 4> fair{}; // 启用公平调度时INTERACTIVE和NOTICE通道前面的按账号调度器
+
+        const Executor& laneExecutor(Lane lane) const {
+            return lanes[static_cast<std::size_t>(lane)];
+        }
+        // API结果的续体回到发起调用的通道；在IO线程或用户线程上发起时没有通道，使用LIFECYCLE
+        const Executor& callerExecutor() const {
+            return laneExecutor(t_lane);
+        }
+
+        // 通道任务执行期间标记当前线程所在的通道，任务抛出异常时也会恢复
+        struct LaneScope {
+            explicit LaneScope(Lane lane) : m_previous(t_lane) { t_lane = lane; }
+            ~LaneScope() { t_lane = m_previous; }
+            LaneScope(const LaneScope&) = delete;
+            LaneScope& operator=(const LaneScope&) = delete;
+        private:
+            Lane m_previous;
+        };
+        SessionRegistry sessions;
+        PendingCalls pending;
+        HttpPool http;
+        TransportMetrics metrics;
+        RateLimiter outbound; // 批量调用和广播共用的出站节流
+        TimerWheel timers;
+        TimerWheel::Id session_sweep = 0; // 定期清理重连队列的定时器
+        std::unique_ptr<TimerStore> timer_store{}; // 设置了Config::timer_store时有效
+        std::shared_ptr<Tracer> tracer{}; // 设置了Config::trace时有效，关闭时每个事件只多一次判空
+        std::unique_ptr<Watchdog> watchdog{}; // 设置了Config::watchdog时有效
+        std::unique_ptr<EventDedup> dedup{}; // 设置了Config::dedup时有效
+        std::unique_ptr<MessageStore> messages{}; // 设置了Config::message_store时有效
+        std::unique_ptr<RecallCache> recalls{}; // 设置了Config::recall_cache时有效
+        std::unique_ptr<SearchIndex> search{}; // 设置了Config::search时有效
+        std::unique_ptr<EventBus> bus{}; // 设置了Config::event_bus时有效
+
+        std::unique_ptr<brynet::net::wrapper::HttpListenerBuilder> listener{};
+        std::shared_ptr<ForwardClient> forward{};
+        std::atomic<bool> accepting = false; // 为false时不再派发新事件，API响应仍然会被处理
+
+        // IO回调和事件任务持有共享锁访问BotInstance，BotInstance析构时持有独占锁并置alive为false
+        std::shared_mutex lifetime;
+        bool alive = true;
+
+        // 线程池中本实例的任务计数，单独持有：任务先释放job和context再计数，stop()返回之后任务不再持有context
+        class TaskCounter {
+        public:
+            void started() {
+                ++m_inflight;
+            }
+
+            void finished() {
+                if (--m_inflight == 0) {
+                    std::lock_guard lock(m_mtx);
+                    m_cv.notify_all();
+                }
+            }
+
+            bool waitIdle(std::chrono::steady_clock::time_point deadline) {
+                std::unique_lock lock(m_mtx);
+                return m_cv.wait_until(lock, deadline, [this] { return m_inflight == 0; });
+            }
+
+        private:
+            std::atomic<std::size_t> m_inflight = 0;
+            std::mutex m_mtx;
+            std::condition_variable m_cv;
+        };
+        std::shared_ptr<TaskCounter> tasks = std::make_shared<TaskCounter>();
+
+        // 到达when之后把job投递到BACKGROUND通道，等待期间由IO线程的定时器计时，不占用线程池
+        // 还没有启动时没有线程池，直接在当前线程上等待并执行
+        void runAt(std::chrono::steady_clock::time_point when, Job job) {
+            auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(when - std::chrono::steady_clock::now());
+            const auto& executor = laneExecutor(Lane::BACKGROUND);
+            if (!executor || !runtime) {
+                std::this_thread::sleep_until(when);
+                job();
+            }
+            else if (delay.count() <= 0) {
+                executor(std::move(job));
+            }
+            else {
+                runtime->impl().service->getRandomEventLoop()->runAfter(delay, [executor = executor, job = std::move(job)]() mutable {
+                    executor(std::move(job));
+                });
+            }
+        }
+
+        // 等到线程池中没有本实例的任务或者到达deadline，返回是否已经排空
+        bool waitIdle(std::chrono::steady_clock::time_point deadline) {
+            return tasks->waitIdle(deadline);
+        }
+    };
+}
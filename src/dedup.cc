@@ -0,0 +1,77 @@
+#include "dedup.hh"
+#include <algorithm>
+
+namespace twobot {
+    namespace {
+        // splitmix64的终结函数，把相近的键打散
+        uint64_t _mix(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xbf58476d1ce4e5b9ULL;
+            x ^= x >> 27;
+            x *= 0x94d049bb133111ebULL;
+            x ^= x >> 31;
+            return x;
+        }
+    }
+
+    EventDedup::EventDedup(const DedupConfig& config)
+        : m_config(config)
+    {
+        m_config.capacity = std::max<std::size_t>(m_config.capacity, 1);
+        m_bitCount = (uint64_t(m_config.capacity) * BITS_PER_KEY + 63) / 64 * 64;
+        auto now = std::chrono::steady_clock::now();
+        for (auto& generation : m_generations) {
+            generation.bits.assign(m_bitCount / 64, 0);
+            generation.start = now;
+        }
+    }
+
+    uint64_t EventDedup::keyOf(const EventJson& event) {
+        // 撤回等通知也带有message_id，只有消息事件按它去重
+        auto it = event.find("message_id");
+        if (it != event.end() && it->is_number_integer() && event.value("post_type", "").starts_with("message")) {
+            auto self_id = event.value("self_id", uint64_t(0));
+            return _mix(self_id ^ _mix(it->get<int64_t>()));
+        }
+        return _mix(std::hash<EventJson>()(event));
+    }
+
+    bool EventDedup::contains(const Generation& generation, uint64_t h1, uint64_t h2) const {
+        for (uint32_t i = 0; i < HASHES; ++i) {
+            auto bit = (h1 + i * h2) % m_bitCount;
+            if ((generation.bits[bit / 64] & (uint64_t(1) << (bit % 64))) == 0)
+                return false;
+        }
+        return true;
+    }
+
+    void EventDedup::rotate(std::chrono::steady_clock::time_point now) {
+        m_current ^= 1;
+        auto& generation = m_generations[m_current];
+        std::fill(generation.bits.begin(), generation.bits.end(), 0);
+        generation.count = 0;
+        generation.start = now;
+    }
+
+    bool EventDedup::duplicate(const EventJson& event) {
+        auto key = keyOf(event);
+        // 双重哈希，h2取奇数保证步长与位数互素时能走遍所有位
+        auto h1 = key;
+        auto h2 = _mix(key + 0x9e3779b97f4a7c15ULL) | 1;
+        auto now = std::chrono::steady_clock::now();
+
+        std::lock_guard lock(m_mtx);
+        auto& current = m_generations[m_current];
+        if (now - current.start >= m_config.window || current.count >= m_config.capacity)
+            rotate(now);
+        if (contains(m_generations[0], h1, h2) || contains(m_generations[1], h1, h2))
+            return true;
+        auto& target = m_generations[m_current];
+        for (uint32_t i = 0; i < HASHES; ++i) {
+            auto bit = (h1 + i * h2) % m_bitCount;
+            target.bits[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+        ++target.count;
+        return false;
+    }
+}
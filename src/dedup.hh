@@ -0,0 +1,42 @@
+#pragma once
+#include "twobot.hh"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace twobot {
+    // 按时间窗口去重的轮转布隆过滤器，两代过滤器交替使用，内存固定为2 * capacity * 32位
+    // 每代最多覆盖window时长或capacity个事件，满足任一条件就清空旧的一代，所以一个事件至少在window内
+    // (事件速率超过capacity / window时至少在capacity个事件内)能被识别为重复；每个键32位、22个哈希，误判率约2e-7
+    class EventDedup {
+    public:
+        explicit EventDedup(const DedupConfig& config);
+
+        // 返回事件是否在窗口内出现过，没出现过的同时记录下来
+        bool duplicate(const EventJson& event);
+
+        // 消息事件按(self_id, message_id)，其余按整个事件内容的哈希
+        static uint64_t keyOf(const EventJson& event);
+
+    private:
+        static constexpr uint32_t BITS_PER_KEY = 32;
+        static constexpr uint32_t HASHES = 22;
+
+        struct Generation {
+            std::vector<uint64_t> bits;
+            std::size_t count = 0;
+            std::chrono::steady_clock::time_point start{};
+        };
+
+        bool contains(const Generation& generation, uint64_t h1, uint64_t h2) const;
+        void rotate(std::chrono::steady_clock::time_point now);
+
+        DedupConfig m_config;
+        uint64_t m_bitCount;
+        std::mutex m_mtx;
+        Generation m_generations[2];
+        std::size_t m_current = 0;
+    };
+}
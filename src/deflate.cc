@@ -0,0 +1,191 @@
+#include "deflate.hh"
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+namespace twobot {
+    namespace {
+        constexpr unsigned char TAIL[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+        std::string_view _trim(std::string_view text) {
+            while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+                text.remove_prefix(1);
+            while (!text.empty() && (text.back() == ' ' || text.back() == '\t'))
+                text.remove_suffix(1);
+            return text;
+        }
+
+        // 解压一条消息，补上发送方去掉的同步刷新结尾
+        std::string _inflate(z_stream& stream, std::string_view payload, std::size_t limit) {
+            std::string out;
+            std::size_t produced = 0;
+            auto feed = [&](const void* data, std::size_t size) {
+                stream.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(data));
+                stream.avail_in = static_cast<uInt>(size);
+                do {
+                    if (produced == out.size())
+                        out.resize(std::max<std::size_t>(out.size() * 2, payload.size() * 4 + 64));
+                    if (out.size() > limit)
+                        throw std::runtime_error("decompressed message is too large");
+                    stream.next_out = reinterpret_cast<Bytef*>(out.data() + produced);
+                    stream.avail_out = static_cast<uInt>(out.size() - produced);
+                    auto ret = inflate(&stream, Z_SYNC_FLUSH);
+                    if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END)
+                        throw std::runtime_error(stream.msg != nullptr ? stream.msg : "inflate failed");
+                    produced = out.size() - stream.avail_out;
+                    if (ret == Z_STREAM_END) {
+                        // 发送方用了BFINAL块，之后的数据从新的流开始
+                        inflateReset(&stream);
+                        if (stream.avail_in == 0)
+                            break;
+                    }
+                } while (stream.avail_in > 0 || stream.avail_out == 0);
+            };
+            feed(payload.data(), payload.size());
+            feed(TAIL, sizeof(TAIL));
+            out.resize(produced);
+            return out;
+        }
+
+        // zlib的原始deflate不支持8位窗口
+        int _window_bits(int bits) {
+            return std::clamp(bits, 9, 15);
+        }
+    }
+
+    std::string PerMessageDeflate::offer(const DeflateConfig& config) {
+        std::string offer = "permessage-deflate";
+        offer += "; client_max_window_bits=" + std::to_string(_window_bits(config.client_max_window_bits));
+        if (_window_bits(config.server_max_window_bits) < 15)
+            offer += "; server_max_window_bits=" + std::to_string(_window_bits(config.server_max_window_bits));
+        if (config.client_no_context_takeover)
+            offer += "; client_no_context_takeover";
+        if (config.server_no_context_takeover)
+            offer += "; server_no_context_takeover";
+        return offer;
+    }
+
+    std::shared_ptr<PerMessageDeflate> PerMessageDeflate::negotiate(const DeflateConfig& config, const std::string& response) {
+        // 可能有多个扩展，以逗号分隔，参数以分号分隔
+        std::string_view header = response;
+        while (!header.empty()) {
+            auto comma = header.find(',');
+            auto extension = header.substr(0, comma);
+            header = comma == std::string_view::npos ? std::string_view() : header.substr(comma + 1);
+
+            auto semicolon = extension.find(';');
+            if (_trim(extension.substr(0, semicolon)) != "permessage-deflate")
+                continue;
+            auto window_bits = _window_bits(config.client_max_window_bits);
+            bool compress_reset = config.client_no_context_takeover;
+            bool decompress_reset = false;
+            auto params = semicolon == std::string_view::npos ? std::string_view() : extension.substr(semicolon + 1);
+            while (!params.empty()) {
+                auto next = params.find(';');
+                auto param = _trim(params.substr(0, next));
+                params = next == std::string_view::npos ? std::string_view() : params.substr(next + 1);
+                auto eq = param.find('=');
+                auto key = _trim(param.substr(0, eq));
+                auto value = eq == std::string_view::npos ? std::string_view() : _trim(param.substr(eq + 1));
+                if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+                    value = value.substr(1, value.size() - 2);
+                if (key == "client_no_context_takeover")
+                    compress_reset = true;
+                else if (key == "server_no_context_takeover")
+                    decompress_reset = true;
+                else if (key == "client_max_window_bits" && !value.empty())
+                    window_bits = std::min(window_bits, _window_bits(std::atoi(std::string(value).c_str())));
+                // server_max_window_bits不影响解压，15位窗口可以解开任意更小窗口的数据
+            }
+            return std::make_shared<PerMessageDeflate>(config, window_bits, compress_reset, decompress_reset);
+        }
+        return nullptr;
+    }
+
+    PerMessageDeflate::PerMessageDeflate(const DeflateConfig& config, int compress_window_bits, bool compress_reset, bool decompress_reset)
+        : m_threshold(config.threshold)
+        , m_compressReset(compress_reset)
+        , m_decompressReset(decompress_reset)
+    {
+        if (deflateInit2(&m_deflate, std::clamp(config.level, 1, 9), Z_DEFLATED, -_window_bits(compress_window_bits), 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error("deflateInit2 failed");
+        if (inflateInit2(&m_inflate, -15) != Z_OK) {
+            deflateEnd(&m_deflate);
+            throw std::runtime_error("inflateInit2 failed");
+        }
+    }
+
+    PerMessageDeflate::~PerMessageDeflate() {
+        deflateEnd(&m_deflate);
+        inflateEnd(&m_inflate);
+    }
+
+    std::string PerMessageDeflate::compress(std::string_view payload) {
+        std::lock_guard lock(m_compressMtx);
+        std::string out;
+        out.resize(deflateBound(&m_deflate, static_cast<uLong>(payload.size())) + 16);
+        m_deflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data()));
+        m_deflate.avail_in = static_cast<uInt>(payload.size());
+        std::size_t produced = 0;
+        // 同步刷新，输出以00 00 FF FF结尾，按协议去掉这四个字节
+        do {
+            if (produced == out.size())
+                out.resize(out.size() * 2);
+            m_deflate.next_out = reinterpret_cast<Bytef*>(out.data() + produced);
+            m_deflate.avail_out = static_cast<uInt>(out.size() - produced);
+            deflate(&m_deflate, Z_SYNC_FLUSH);
+            produced = out.size() - m_deflate.avail_out;
+        } while (m_deflate.avail_out == 0);
+        out.resize(produced);
+        if (out.size() >= 4 && std::equal(std::begin(TAIL), std::end(TAIL), out.end() - 4, [](unsigned char a, char b) { return a == static_cast<unsigned char>(b); }))
+            out.resize(out.size() - 4);
+        if (m_compressReset)
+            deflateReset(&m_deflate);
+        return out;
+    }
+
+    std::string PerMessageDeflate::decompress(std::string_view payload) {
+        std::lock_guard lock(m_decompressMtx);
+        auto out = _inflate(m_inflate, payload, MAX_MESSAGE);
+        if (m_decompressReset)
+            inflateReset(&m_inflate);
+        return out;
+    }
+
+    std::string buildTextFrame(std::string_view payload, bool masking, bool compressed) {
+        std::string frame;
+        frame.reserve(payload.size() + 14);
+        frame += static_cast<char>(0x81 | (compressed ? 0x40 : 0x00)); // FIN + 文本帧
+        auto mask_bit = static_cast<unsigned char>(masking ? 0x80 : 0x00);
+        auto size = static_cast<uint64_t>(payload.size());
+        if (size < 126) {
+            frame += static_cast<char>(mask_bit | size);
+        }
+        else if (size <= 0xFFFF) {
+            frame += static_cast<char>(mask_bit | 126);
+            frame += static_cast<char>(size >> 8);
+            frame += static_cast<char>(size & 0xFF);
+        }
+        else {
+            frame += static_cast<char>(mask_bit | 127);
+            for (int shift = 56; shift >= 0; shift -= 8)
+                frame += static_cast<char>((size >> shift) & 0xFF);
+        }
+        if (!masking) {
+            frame.append(payload);
+            return frame;
+        }
+        thread_local std::mt19937 rng{ std::random_device{}() };
+        uint32_t key = rng();
+        unsigned char mask[4] = {
+            static_cast<unsigned char>(key >> 24), static_cast<unsigned char>(key >> 16),
+            static_cast<unsigned char>(key >> 8), static_cast<unsigned char>(key)
+        };
+        frame.append(reinterpret_cast<const char*>(mask), 4);
+        auto offset = frame.size();
+        frame.append(payload);
+        for (std::size_t i = 0; i < payload.size(); ++i)
+            frame[offset + i] = static_cast<char>(frame[offset + i] ^ mask[i % 4]);
+        return frame;
+    }
+}
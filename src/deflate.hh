@@ -0,0 +1,46 @@
+#pragma once
+#include "twobot.hh"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+namespace twobot {
+    // WebSocket的permessage-deflate扩展(RFC 7692)，每条连接一个，压缩和解压各自持有上下文，
+    // 开启上下文接管时前后消息共享滑动窗口，所以压缩顺序必须与发送顺序一致
+    class PerMessageDeflate {
+    public:
+        // 客户端握手请求中的Sec-WebSocket-Extensions
+        static std::string offer(const DeflateConfig& config);
+        // 按服务端握手响应中的Sec-WebSocket-Extensions确定参数，服务端没有接受扩展时返回nullptr
+        static std::shared_ptr<PerMessageDeflate> negotiate(const DeflateConfig& config, const std::string& response);
+
+        PerMessageDeflate(const DeflateConfig& config, int compress_window_bits, bool compress_reset, bool decompress_reset);
+        ~PerMessageDeflate();
+
+        PerMessageDeflate(const PerMessageDeflate&) = delete;
+        PerMessageDeflate& operator=(const PerMessageDeflate&) = delete;
+
+        // 短于threshold的消息不压缩
+        bool shouldCompress(std::string_view payload) const { return payload.size() >= m_threshold; }
+        std::string compress(std::string_view payload);
+        // 数据损坏或者超过解压上限时抛出异常，此后连接上的上下文已经不可用
+        // brynet交给回调的负载不带RSV1位，协商成功后收到的每条数据消息都按压缩过的处理
+        std::string decompress(std::string_view payload);
+
+    private:
+        static constexpr std::size_t MAX_MESSAGE = 64 * 1024 * 1024; // 解压后的上限，防止压缩炸弹
+
+        std::size_t m_threshold;
+        bool m_compressReset;
+        bool m_decompressReset;
+        std::mutex m_compressMtx;
+        std::mutex m_decompressMtx;
+        z_stream m_deflate{};
+        z_stream m_inflate{};
+    };
+
+    // 封装一个文本帧，compressed时置RSV1位；masking为true时按客户端的要求加掩码
+    std::string buildTextFrame(std::string_view payload, bool masking, bool compressed);
+}
@@ -0,0 +1,118 @@
+#include "fair.hh"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+namespace twobot {
+    FairScheduler::FairScheduler(Executor executor, const FairConfig& config)
+        : m_executor(std::move(executor))
+        , m_concurrency(std::max<std::size_t>(config.concurrency, 1))
+        , m_perAccount(std::max<std::size_t>(config.per_account, 1))
+        , m_quantum(std::max<int64_t>(config.quantum.count(), 1))
+    {
+
+    }
+
+    void FairScheduler::submit(uint64_t account, Job job) {
+        bool spawn = false;
+        {
+            std::lock_guard lock(m_mtx);
+            auto& state = m_accounts[account];
+            state.queue.push_back(std::move(job));
+            if (!state.active) {
+                state.active = true;
+                m_ring.push_back(account);
+            }
+            if (m_workers < m_concurrency) {
+                ++m_workers;
+                spawn = true;
+            }
+        }
+        if (spawn)
+            m_executor([self = shared_from_this()] { self->work(); });
+    }
+
+    TenantStats FairScheduler::stats(uint64_t account) const {
+        std::lock_guard lock(m_mtx);
+        auto it = m_accounts.find(account);
+        if (it == m_accounts.end())
+            return {};
+        const auto& state = it->second;
+        return { state.queue.size(), state.running, state.handled, state.handler_us_avg / 1000.0, state.handler_us_total / 1000.0 };
+    }
+
+    bool FairScheduler::pick(uint64_t& account, Job& job) {
+        // 第一轮按现有额度找，全都用完时统一补充，使额度最多的可运行账号转正，再找一轮
+        for (int round = 0; round < 2; ++round) {
+            int64_t best = std::numeric_limits<int64_t>::min();
+            for (std::size_t n = m_ring.size(); n > 0; --n) {
+                auto id = m_ring.front();
+                auto& state = m_accounts[id];
+                if (state.queue.empty()) {
+                    m_ring.pop_front();
+                    state.active = false;
+                    // 空队列不能积攒额度
+                    state.deficit = std::min<int64_t>(state.deficit, 0);
+                    continue;
+                }
+                if (state.running < m_perAccount) {
+                    if (state.deficit > 0) {
+                        account = id;
+                        job = std::move(state.queue.front());
+                        state.queue.pop_front();
+                        ++state.running;
+                        return true;
+                    }
+                    best = std::max(best, state.deficit);
+                }
+                m_ring.pop_front();
+                m_ring.push_back(id);
+            }
+            if (best == std::numeric_limits<int64_t>::min())
+                return false;
+            auto rounds = (-best) / m_quantum + 1;
+            for (auto id : m_ring) {
+                auto& state = m_accounts[id];
+                if (state.running < m_perAccount)
+                    state.deficit += rounds * m_quantum;
+            }
+        }
+        return false;
+    }
+
+    void FairScheduler::finish(uint64_t account, std::chrono::microseconds cost) {
+        auto& state = m_accounts[account];
+        --state.running;
+        state.deficit -= cost.count();
+        ++state.handled;
+        double us = static_cast<double>(cost.count());
+        state.handler_us_total += us;
+        state.handler_us_avg = state.handled == 1 ? us : state.handler_us_avg + ALPHA * (us - state.handler_us_avg);
+    }
+
+    // 每次只执行一个任务然后重新投递，让出线程给同一执行器上的其他任务
+    void FairScheduler::work() {
+        uint64_t account;
+        Job job;
+        {
+            std::lock_guard lock(m_mtx);
+            if (!pick(account, job)) {
+                --m_workers;
+                return;
+            }
+        }
+        auto begin = std::chrono::steady_clock::now();
+        try {
+            job();
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Fair Scheduler Exception: " << e.what() << std::endl;
+        }
+        auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin);
+        {
+            std::lock_guard lock(m_mtx);
+            finish(account, cost);
+        }
+        m_executor([self = shared_from_this()] { self->work(); });
+    }
+}
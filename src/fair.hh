@@ -0,0 +1,47 @@
+#pragma once
+#include "twobot.hh"
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace twobot {
+    // 按账号(self_id)公平调度：每个账号一个队列，按赤字轮转(DRR)出队，
+    // 额度按处理函数的实际耗时扣除，单个账号刷屏时只消耗自己的额度，不会饿死其他账号
+    class FairScheduler : public std::enable_shared_from_this<FairScheduler> {
+    public:
+        FairScheduler(Executor executor, const FairConfig& config);
+
+        void submit(uint64_t account, Job job);
+        TenantStats stats(uint64_t account) const;
+
+    private:
+        struct Account {
+            std::deque<Job> queue;
+            std::size_t running = 0;
+            int64_t deficit = 0; // 剩余额度，单位微秒，执行结束后扣除实际耗时
+            bool active = false; // 是否在轮转队列中
+            uint64_t handled = 0;
+            double handler_us_total = 0;
+            double handler_us_avg = 0;
+        };
+
+        static constexpr double ALPHA = 0.2; // 平均耗时的滑动平均权重
+
+        // 按DRR取出下一个可以执行的任务，没有时返回false
+        bool pick(uint64_t& account, Job& job);
+        void finish(uint64_t account, std::chrono::microseconds cost);
+        void work();
+
+        Executor m_executor;
+        std::size_t m_concurrency;
+        std::size_t m_perAccount;
+        int64_t m_quantum;
+
+        mutable std::mutex m_mtx;
+        std::unordered_map<uint64_t, Account> m_accounts;
+        std::deque<uint64_t> m_ring; // 有排队任务的账号
+        std::size_t m_workers = 0;
+    };
+}
@@ -0,0 +1,176 @@
+#include "forward.hh"
+#include <iostream>
+#include <random>
+#include <brynet/net/http/HttpFormat.hpp>
+
+namespace twobot {
+    using namespace brynet::net;
+    using namespace brynet::net::http;
+
+    namespace {
+        // brynet只接受IP地址，去掉Config::host中可能带有的协议前缀和路径
+        std::string _strip_host(std::string host)
+        {
+            auto scheme = host.find("://");
+            if (scheme != std::string::npos)
+                host.erase(0, scheme + 3);
+            auto path = host.find('/');
+            if (path != std::string::npos)
+                host.erase(path);
+            return host;
+        }
+
+        std::string _random_ws_key()
+        {
+            static constexpr char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            std::random_device rd;
+            unsigned char bytes[16];
+            for (auto& b : bytes)
+                b = static_cast<unsigned char>(rd());
+            std::string key;
+            for (std::size_t i = 0; i < sizeof(bytes); i += 3) {
+                uint32_t n = bytes[i] << 16;
+                if (i + 1 < sizeof(bytes)) n |= bytes[i + 1] << 8;
+                if (i + 2 < sizeof(bytes)) n |= bytes[i + 2];
+                key += table[(n >> 18) & 63];
+                key += table[(n >> 12) & 63];
+                key += i + 1 < sizeof(bytes) ? table[(n >> 6) & 63] : '=';
+                key += i + 2 < sizeof(bytes) ? table[n & 63] : '=';
+            }
+            return key;
+        }
+    }
+
+    std::shared_ptr<ForwardClient> ForwardClient::create(
+        IOThreadTcpService::Ptr service,
+        AsyncConnector::Ptr connector,
+        Options options,
+        PayloadCallback on_payload,
+        ClosedCallback on_closed)
+    {
+        return std::shared_ptr<ForwardClient>(new ForwardClient(
+            std::move(service), std::move(connector), std::move(options), std::move(on_payload), std::move(on_closed)));
+    }
+
+    ForwardClient::ForwardClient(IOThreadTcpService::Ptr service,
+        AsyncConnector::Ptr connector,
+        Options options,
+        PayloadCallback on_payload,
+        ClosedCallback on_closed)
+        : m_service(std::move(service))
+        , m_connector(std::move(connector))
+        , m_options(std::move(options))
+        , m_onPayload(std::move(on_payload))
+        , m_onClosed(std::move(on_closed))
+        , m_backoffMs(m_options.min_backoff.count())
+    {
+        m_options.host = _strip_host(m_options.host);
+    }
+
+    void ForwardClient::start() {
+        m_stopped = false;
+        connect();
+    }
+
+    void ForwardClient::stop() {
+        m_stopped = true;
+        std::lock_guard lock(m_mtx);
+        if (auto session = m_session.lock())
+            session->postClose();
+    }
+
+    std::shared_ptr<PerMessageDeflate> ForwardClient::deflate() const {
+        std::lock_guard lock(m_mtx);
+        return m_deflate;
+    }
+
+    std::string ForwardClient::buildHandshake() const {
+        HttpRequest request;
+        request.setMethod(HttpRequest::HTTP_METHOD::HTTP_METHOD_GET);
+        request.setUrl(m_options.path);
+        request.addHeadValue("Host", m_options.host + ":" + std::to_string(m_options.port));
+        request.addHeadValue("Upgrade", "websocket");
+        request.addHeadValue("Connection", "Upgrade");
+        request.addHeadValue("Sec-WebSocket-Key", _random_ws_key());
+        request.addHeadValue("Sec-WebSocket-Version", "13");
+        if (m_options.token)
+            request.addHeadValue("Authorization", "Bearer " + *m_options.token);
+        if (m_options.deflate)
+            request.addHeadValue("Sec-WebSocket-Extensions", PerMessageDeflate::offer(*m_options.deflate));
+        return request.getResult();
+    }
+
+    void ForwardClient::connect() {
+        if (m_stopped)
+            return;
+        auto self = shared_from_this();
+        wrapper::HttpConnectionBuilder()
+            .WithConnector(m_connector)
+            .WithService(m_service)
+            .WithAddr(m_options.host, m_options.port)
+            .WithTimeout(std::chrono::seconds(10))
+            .AddSocketProcess([](TcpSocket& socket) {
+                socket.setNodelay();
+            })
+            .WithFailedCallback([self] {
+                std::cerr << "Forward WebSocket connect failed, retry in " << self->m_backoffMs << "ms" << std::endl;
+                self->scheduleReconnect();
+            })
+            .WithMaxRecvBufferSize(static_cast<size_t>(1024 * 1024 * 4))
+            .WithEnterCallback([self](const HttpSession::Ptr& httpSession, HttpSessionHandlers& handlers) {
+                {
+                    std::lock_guard lock(self->m_mtx);
+                    self->m_session = httpSession;
+                    self->m_deflate = nullptr;
+                }
+                handlers.setWSConnected([self](const HttpSession::Ptr&, const HTTPParser& parser) {
+                    self->m_backoffMs = self->m_options.min_backoff.count();
+                    if (!self->m_options.deflate || !parser.hasKey("Sec-WebSocket-Extensions"))
+                        return;
+                    auto deflate = PerMessageDeflate::negotiate(*self->m_options.deflate, parser.getValue("Sec-WebSocket-Extensions"));
+                    std::lock_guard lock(self->m_mtx);
+                    self->m_deflate = std::move(deflate);
+                });
+                handlers.setWSCallback([self](const HttpSession::Ptr& httpSession,
+                    WebSocketFormat::WebSocketFrameType opcode,
+                    const std::string& payload) {
+                        if (opcode != WebSocketFormat::WebSocketFrameType::TEXT_FRAME
+                            && opcode != WebSocketFormat::WebSocketFrameType::BINARY_FRAME)
+                            return;
+                        auto deflate = self->deflate();
+                        if (!deflate) {
+                            self->m_onPayload(payload, httpSession);
+                            return;
+                        }
+                        // 按协商结果区分：协商了压缩的连接上每条消息都要解压；解压失败后上下文已经错乱，只能断开重连
+                        std::string inflated;
+                        try {
+                            inflated = deflate->decompress(payload);
+                        }
+                        catch (const std::exception& e) {
+                            std::cerr << "Forward WebSocket inflate failed: " << e.what() << std::endl;
+                            httpSession->postClose();
+                            return;
+                        }
+                        self->m_onPayload(inflated, httpSession);
+                });
+                handlers.setClosedCallback([self](const HttpSession::Ptr& httpSession) {
+                    self->m_onClosed(httpSession);
+                    self->scheduleReconnect();
+                });
+                auto handshake = self->buildHandshake();
+                httpSession->send(handshake.c_str(), handshake.size());
+            })
+            .asyncConnect();
+    }
+
+    void ForwardClient::scheduleReconnect() {
+        if (m_stopped)
+            return;
+        auto delay = m_backoffMs.load();
+        m_backoffMs = std::min<int64_t>(delay * 2, m_options.max_backoff.count());
+        m_service->getRandomEventLoop()->runAfter(std::chrono::milliseconds(delay), [self = shared_from_this()] {
+            self->connect();
+        });
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "twobot.hh"
+#include "deflate.hh"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <brynet/net/AsyncConnector.hpp>
+#include <brynet/net/http/HttpService.hpp>
+#include <brynet/net/wrapper/HttpConnectionBuilder.hpp>
+
+namespace twobot {
+    // 正向WS客户端，主动连接OneBot实现的正向WS服务，事件和API调用复用同一条连接
+    // 连接失败或断开后按指数退避自动重连，握手成功后退避时间复位
+    class ForwardClient : public std::enable_shared_from_this<ForwardClient> {
+    public:
+        using SessionPtr = brynet::net::http::HttpSession::Ptr;
+        using PayloadCallback = std::function<void(const std::string&, const SessionPtr&)>;
+        using ClosedCallback = std::function<void(const SessionPtr&)>;
+
+        struct Options {
+            std::string host; // 必须是IP地址，可以带http://或ws://前缀
+            uint16_t port;
+            std::string path = "/";
+            std::optional<std::string> token = std::nullopt;
+            std::chrono::milliseconds min_backoff{ 500 };
+            std::chrono::milliseconds max_backoff{ 30000 };
+            std::optional<DeflateConfig> deflate = std::nullopt; // 设置后握手时请求permessage-deflate
+        };
+
+        static std::shared_ptr<ForwardClient> create(
+            brynet::net::IOThreadTcpService::Ptr service,
+            brynet::net::AsyncConnector::Ptr connector,
+            Options options,
+            PayloadCallback on_payload,
+            ClosedCallback on_closed);
+
+        void start();
+        // 停止重连并关闭当前连接
+        void stop();
+        // 当前连接协商出的压缩上下文，没有协商成功时为nullptr
+        std::shared_ptr<PerMessageDeflate> deflate() const;
+
+    private:
+        ForwardClient(brynet::net::IOThreadTcpService::Ptr service,
+            brynet::net::AsyncConnector::Ptr connector,
+            Options options,
+            PayloadCallback on_payload,
+            ClosedCallback on_closed);
+
+        void connect();
+        void scheduleReconnect();
+        std::string buildHandshake() const;
+
+        brynet::net::IOThreadTcpService::Ptr m_service;
+        brynet::net::AsyncConnector::Ptr m_connector;
+        Options m_options;
+        PayloadCallback m_onPayload;
+        ClosedCallback m_onClosed;
+
+        std::atomic<bool> m_stopped{ false };
+        std::atomic<int64_t> m_backoffMs;
+        mutable std::mutex m_mtx;
+        std::weak_ptr<brynet::net::http::HttpSession> m_session;
+        std::shared_ptr<PerMessageDeflate> m_deflate;
+    };
+}
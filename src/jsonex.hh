@@ -4,7 +4,8 @@
 namespace nlohmann {
     template <typename T>
     struct adl_serializer<std::optional<T>> {
-        static void to_json(json& j, const std::optional<T>& opt) {
+        template<typename BasicJsonType>
+        static void to_json(BasicJsonType& j, const std::optional<T>& opt) {
             if (opt == std::nullopt) {
                 j = nullptr;
             }
@@ -14,7 +15,8 @@ namespace nlohmann {
             }
         }
 
-        static void from_json(const json& j, std::optional<T>& opt) {
+        template<typename BasicJsonType>
+        static void from_json(const BasicJsonType& j, std::optional<T>& opt) {
             if (j.is_null()) {
                 opt = std::nullopt;
             }
@@ -26,15 +28,48 @@ namespace nlohmann {
     };
 }
 
+// 与NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT相同，但适用于任意basic_json，事件直接从EventJson解码
+#define TWOBOT_DEFINE_EVENT_WITH_DEFAULT(Type, ...) \
+    template<typename BasicJsonType, nlohmann::detail::enable_if_t<nlohmann::detail::is_basic_json<BasicJsonType>::value, int> = 0> \
+    void to_json(BasicJsonType& nlohmann_json_j, const Type& nlohmann_json_t) { NLOHMANN_JSON_EXPAND(NLOHMANN_JSON_PASTE(NLOHMANN_JSON_TO, __VA_ARGS__)) } \
+    template<typename BasicJsonType, nlohmann::detail::enable_if_t<nlohmann::detail::is_basic_json<BasicJsonType>::value, int> = 0> \
+    void from_json(const BasicJsonType& nlohmann_json_j, Type& nlohmann_json_t) { Type nlohmann_json_default_obj; NLOHMANN_JSON_EXPAND(NLOHMANN_JSON_PASTE(NLOHMANN_JSON_FROM_WITH_DEFAULT, __VA_ARGS__)) }
+
 namespace twobot {
     namespace Event {
+        NLOHMANN_JSON_SERIALIZE_ENUM(Sender::ROLE, {
+            {Sender::ROLE::NONE, nullptr},
+            {Sender::ROLE::OWNER, "owner"},
+            {Sender::ROLE::ADMIN, "admin"},
+            {Sender::ROLE::MEMBER, "member"},
+        })
+
+        NLOHMANN_JSON_SERIALIZE_ENUM(Sender::SEX, {
+            {Sender::SEX::UNKNOWN, "unknown"},
+            {Sender::SEX::MALE, "male"},
+            {Sender::SEX::FEMALE, "female"},
+        })
+
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(Sender, user_id, nickname, card, role, sex, age, level, title)
+
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(RecalledMessage, user_id, time, message)
+    }
+
+    TWOBOT_DEFINE_EVENT_WITH_DEFAULT(ApiSet::FriendInfo, user_id, nickname, remark)
+
+    TWOBOT_DEFINE_EVENT_WITH_DEFAULT(ApiSet::GroupInfo, group_id, group_name, member_count, max_member_count)
+
+    TWOBOT_DEFINE_EVENT_WITH_DEFAULT(ApiSet::GroupMemberInfo, group_id, user_id, nickname, card, sex, age, area, join_time, last_sent_time, level, role, unfriendly, title, title_expire_time, card_changeable)
+
+    namespace Event {
+
         NLOHMANN_JSON_SERIALIZE_ENUM(PrivateMsg::SUB_TYPE, {
             {PrivateMsg::SUB_TYPE::FRIEND, "friend"},
             {PrivateMsg::SUB_TYPE::GROUP, "group"},
             {PrivateMsg::SUB_TYPE::OTHER, "other"},
         })
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(PrivateMsg, time, user_id, self_id, raw_message, sub_type, sender)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(PrivateMsg, time, user_id, self_id, raw_message, sub_type, sender)
 
         NLOHMANN_JSON_SERIALIZE_ENUM(GroupMsg::SUB_TYPE, {
             {GroupMsg::SUB_TYPE::NORMAL, "normal"},
@@ -42,22 +77,22 @@ namespace twobot {
             {GroupMsg::SUB_TYPE::NOTICE, "notice"},
         })
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(GroupMsg, time, user_id, self_id, group_id, raw_message, group_name, sub_type, sender)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(GroupMsg, time, user_id, self_id, group_id, raw_message, group_name, sub_type, sender)
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(EnableEvent, time, self_id)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(EnableEvent, time, self_id)
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(DisableEvent, time, self_id)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(DisableEvent, time, self_id)
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(ConnectEvent, time, self_id)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(ConnectEvent, time, self_id)
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(GroupUploadNotice, time, user_id, self_id, group_id, file)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(GroupUploadNotice, time, user_id, self_id, group_id, file)
 
         NLOHMANN_JSON_SERIALIZE_ENUM(GroupAdminNotice::SUB_TYPE, {
             {GroupAdminNotice::SUB_TYPE::SET, "set"},
             {GroupAdminNotice::SUB_TYPE::UNSET, "unset"},
         })
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(GroupAdminNotice, time, user_id, self_id, group_id, sub_type)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(GroupAdminNotice, time, user_id, self_id, group_id, sub_type)
 
         NLOHMANN_JSON_SERIALIZE_ENUM(GroupDecreaseNotice::SUB_TYPE, {
             {GroupDecreaseNotice::SUB_TYPE::LEAVE, "leave"},
@@ -65,27 +100,27 @@ namespace twobot {
             {GroupDecreaseNotice::SUB_TYPE::KICK_ME, "kick_me"}
         })
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(GroupDecreaseNotice, time, user_id, self_id, group_id, operator_id, sub_type)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(GroupDecreaseNotice, time, user_id, self_id, group_id, operator_id, sub_type)
 
         NLOHMANN_JSON_SERIALIZE_ENUM(GroupInceaseNotice::SUB_TYPE, {
             {GroupInceaseNotice::SUB_TYPE::APPROVE, "approve"},
             {GroupInceaseNotice::SUB_TYPE::INVITE, "invite"}
         })
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(GroupInceaseNotice, time, user_id, self_id, group_id, operator_id, sub_type)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(GroupInceaseNotice, time, user_id, self_id, group_id, operator_id, sub_type)
 
         NLOHMANN_JSON_SERIALIZE_ENUM(GroupBanNotice::SUB_TYPE, {
             {GroupBanNotice::SUB_TYPE::BAN, "ban"},
             {GroupBanNotice::SUB_TYPE::LIFT_BAN, "lift_ban"}
         })
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(GroupBanNotice, time, user_id, self_id, group_id, operator_id, duration, sub_type)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(GroupBanNotice, time, user_id, self_id, group_id, operator_id, duration, sub_type)
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(FriendAddNotice, time, user_id, self_id)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(FriendAddNotice, time, user_id, self_id)
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(GroupRecallNotice, time, user_id, self_id, group_id, message_id, operator_id)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(GroupRecallNotice, time, user_id, self_id, group_id, message_id, operator_id, original)
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(FriendRecallNotice, time, user_id, self_id, message_id)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(FriendRecallNotice, time, user_id, self_id, message_id, original)
 
         NLOHMANN_JSON_SERIALIZE_ENUM(GroupNotifyNotice::SUB_TYPE, {
             {GroupNotifyNotice::SUB_TYPE::POKE, "poke"},
@@ -99,6 +134,6 @@ namespace twobot {
             {GroupNotifyNotice::HonorType::EMOTION, "emotion"}
         })
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(GroupNotifyNotice, time, user_id, self_id, group_id, sub_type, target_id, honor_type)
+        TWOBOT_DEFINE_EVENT_WITH_DEFAULT(GroupNotifyNotice, time, user_id, self_id, group_id, sub_type, target_id, honor_type)
     }
 }
\ No newline at end of file
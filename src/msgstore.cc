@@ -0,0 +1,418 @@
+#include "msgstore.hh"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <unordered_set>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace twobot {
+    namespace {
+        constexpr char MAGIC[8] = { 'T', 'W', 'O', 'B', 'M', 'S', 'G', '1' };
+
+        // 记录头之后紧跟raw，整条记录按8字节对齐；size最后写入，为0表示段内数据到此为止
+        struct RecordHeader {
+            uint32_t size; // raw的字节数
+            uint32_t reserved;
+            uint64_t self_id;
+            int64_t message_id;
+            uint64_t group_id; // 私聊为0
+            uint64_t user_id;
+            int64_t time;
+        };
+
+        uint64_t _align(uint64_t size) {
+            return (size + 7) & ~uint64_t(7);
+        }
+
+        std::filesystem::path _segment_path(const std::filesystem::path& dir, uint64_t seq) {
+            std::ostringstream name;
+            name << std::setw(16) << std::setfill('0') << seq << ".seg";
+            return dir / name.str();
+        }
+    }
+
+    // 一个映射到内存的段文件，新建时扩展到size，已有的按文件实际大小映射
+    class MappedSegment {
+    public:
+        MappedSegment(uint64_t seq, std::filesystem::path path, std::size_t size)
+            : seq(seq)
+            , path(std::move(path))
+        {
+#ifdef _WIN32
+            m_file = CreateFileW(this->path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (m_file == INVALID_HANDLE_VALUE)
+                throw std::runtime_error("cannot open " + this->path.string());
+            LARGE_INTEGER current;
+            GetFileSizeEx(m_file, &current);
+            m_size = current.QuadPart > 0 ? static_cast<std::size_t>(current.QuadPart) : size;
+            LARGE_INTEGER length;
+            length.QuadPart = static_cast<LONGLONG>(m_size);
+            m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READWRITE, length.HighPart, length.LowPart, nullptr);
+            if (m_mapping != nullptr)
+                m_data = static_cast<char*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_size));
+            if (m_data == nullptr) {
+                close();
+                throw std::runtime_error("cannot map " + this->path.string());
+            }
+#else
+            m_fd = ::open(this->path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (m_fd < 0)
+                throw std::runtime_error("cannot open " + this->path.string());
+            struct stat st {};
+            fstat(m_fd, &st);
+            m_size = st.st_size > 0 ? static_cast<std::size_t>(st.st_size) : size;
+            // 新文件预先分配磁盘空间，稀疏文件在磁盘写满时只会在写映射区时收到SIGBUS
+            if (st.st_size == 0) {
+                auto error = posix_fallocate(m_fd, 0, static_cast<off_t>(m_size));
+                if (error != 0) {
+                    close();
+                    std::error_code ec;
+                    std::filesystem::remove(this->path, ec);
+                    throw std::runtime_error("cannot allocate " + this->path.string() + ": " + std::strerror(error));
+                }
+            }
+            auto data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+            if (data == MAP_FAILED) {
+                close();
+                throw std::runtime_error("cannot map " + this->path.string());
+            }
+            m_data = static_cast<char*>(data);
+#endif
+        }
+
+        ~MappedSegment() {
+            close();
+        }
+
+        MappedSegment(const MappedSegment&) = delete;
+        MappedSegment& operator=(const MappedSegment&) = delete;
+
+        char* data() const { return m_data; }
+        std::size_t size() const { return m_size; }
+
+        // 把脏页交给系统回写，不等待落盘
+        void flush() {
+#ifdef _WIN32
+            FlushViewOfFile(m_data, 0);
+#else
+            msync(m_data, m_size, MS_ASYNC);
+#endif
+        }
+
+        const uint64_t seq;
+        const std::filesystem::path path;
+        int64_t newest = 0; // 段内最新的消息时间
+
+    private:
+        void close() {
+#ifdef _WIN32
+            if (m_data != nullptr)
+                UnmapViewOfFile(m_data);
+            if (m_mapping != nullptr)
+                CloseHandle(m_mapping);
+            if (m_file != INVALID_HANDLE_VALUE)
+                CloseHandle(m_file);
+            m_data = nullptr;
+            m_mapping = nullptr;
+            m_file = INVALID_HANDLE_VALUE;
+#else
+            if (m_data != nullptr)
+                munmap(m_data, m_size);
+            if (m_fd >= 0)
+                ::close(m_fd);
+            m_data = nullptr;
+            m_fd = -1;
+#endif
+        }
+
+        char* m_data = nullptr;
+        std::size_t m_size = 0;
+#ifdef _WIN32
+        HANDLE m_file = INVALID_HANDLE_VALUE;
+        HANDLE m_mapping = nullptr;
+#else
+        int m_fd = -1;
+#endif
+    };
+
+    MessageStore::MessageStore(const MessageStoreConfig& config)
+        : m_config(config)
+        , m_dir(config.path)
+    {
+        m_config.segment_size = std::max<std::size_t>(m_config.segment_size, 64 * 1024);
+        m_config.max_segments = std::max<std::size_t>(m_config.max_segments, 1);
+        std::filesystem::create_directories(m_dir);
+
+        std::vector<uint64_t> seqs;
+        for (const auto& file : std::filesystem::directory_iterator(m_dir)) {
+            if (file.path().extension() != ".seg")
+                continue;
+            try {
+                seqs.push_back(std::stoull(file.path().stem().string()));
+            }
+            catch (const std::exception&) {
+            }
+        }
+        std::sort(seqs.begin(), seqs.end());
+
+        std::vector<std::unique_ptr<MappedSegment>> segments;
+        for (auto seq : seqs) {
+            auto path = _segment_path(m_dir, seq);
+            try {
+                auto segment = std::make_unique<MappedSegment>(seq, path, m_config.segment_size);
+                if (segment->size() < sizeof(MAGIC) || std::memcmp(segment->data(), MAGIC, sizeof(MAGIC)) != 0) {
+                    std::cerr << "Message Store Error: skipping " << path.string() << ", not a segment file" << std::endl;
+                    continue;
+                }
+                segments.push_back(std::move(segment));
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Message Store Error: " << e.what() << std::endl;
+            }
+        }
+        // 只加载序号连续的最新一段，保证m_segments[seq - m_firstSeq]成立，更早的文件保留在磁盘上不动
+        auto first = segments.size();
+        while (first > 0 && (first == segments.size() || segments[first - 1]->seq + 1 == segments[first]->seq))
+            --first;
+        for (std::size_t i = 0; i < first; ++i)
+            std::cerr << "Message Store Error: skipping " << segments[i]->path.string() << ", segment sequence has a gap" << std::endl;
+
+        std::unique_lock lock(m_mtx);
+        for (auto i = first; i < segments.size(); ++i) {
+            if (m_segments.empty())
+                m_firstSeq = segments[i]->seq;
+            m_segments.push_back(std::move(segments[i]));
+            m_writeOffset = indexSegment(m_segments.back()->seq);
+        }
+        if (m_segments.empty())
+            openSegment(seqs.empty() ? 1 : seqs.back() + 1);
+        // 重启后先按保留策略淘汰一次
+        retire();
+    }
+
+    MessageStore::~MessageStore() {
+        std::unique_lock lock(m_mtx);
+        if (!m_segments.empty())
+            m_segments.back()->flush();
+    }
+
+    void MessageStore::openSegment(uint64_t seq) {
+        auto segment = std::make_unique<MappedSegment>(seq, _segment_path(m_dir, seq), m_config.segment_size);
+        std::memcpy(segment->data(), MAGIC, sizeof(MAGIC));
+        if (m_segments.empty())
+            m_firstSeq = seq;
+        m_segments.push_back(std::move(segment));
+        m_writeOffset = sizeof(MAGIC);
+    }
+
+    uint64_t MessageStore::indexSegment(uint64_t seq) {
+        auto& segment = *m_segments[seq - m_firstSeq];
+        uint64_t offset = sizeof(MAGIC);
+        while (offset + sizeof(RecordHeader) <= segment.size()) {
+            RecordHeader header;
+            std::memcpy(&header, segment.data() + offset, sizeof(header));
+            if (header.size == 0 || offset + sizeof(RecordHeader) + header.size > segment.size())
+                break;
+            auto message = read({ seq, offset });
+            index(message, { seq, offset });
+            segment.newest = std::max(segment.newest, message.time);
+            offset += _align(sizeof(RecordHeader) + header.size);
+        }
+        return offset;
+    }
+
+    void MessageStore::index(const StoredMessage& message, Location location) {
+        m_byId[{ message.self_id, message.message_id }] = location;
+        if (message.group_id == 0)
+            return;
+        // 消息基本按时间顺序到达，乱序时插入到相同时间的最后
+        auto& entries = m_byGroup[message.group_id];
+        auto it = std::upper_bound(entries.begin(), entries.end(), message.time, [](int64_t time, const GroupEntry& entry) {
+            return time < entry.time;
+        });
+        entries.insert(it, { message.time, location });
+    }
+
+    void MessageStore::rotate() {
+        m_segments.back()->flush();
+        openSegment(m_segments.back()->seq + 1);
+        retire();
+    }
+
+    void MessageStore::retire() {
+        // 正在写入的段不淘汰
+        auto cutoff = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch() - m_config.retention).count();
+        while (m_segments.size() > 1 && (m_segments.size() > m_config.max_segments
+            || (m_config.retention.count() > 0 && m_segments.front()->newest < cutoff)))
+            dropOldest();
+    }
+
+    void MessageStore::dropOldest() {
+        auto seq = m_firstSeq;
+        auto& segment = *m_segments.front();
+        // 重新扫描一遍段内的记录，只删除仍然指向这个段的索引
+        std::unordered_set<uint64_t> groups;
+        uint64_t offset = sizeof(MAGIC);
+        while (offset + sizeof(RecordHeader) <= segment.size()) {
+            RecordHeader header;
+            std::memcpy(&header, segment.data() + offset, sizeof(header));
+            if (header.size == 0 || offset + sizeof(RecordHeader) + header.size > segment.size())
+                break;
+            auto it = m_byId.find({ header.self_id, header.message_id });
+            if (it != m_byId.end() && it->second.segment == seq)
+                m_byId.erase(it);
+            if (header.group_id != 0)
+                groups.insert(header.group_id);
+            offset += _align(sizeof(RecordHeader) + header.size);
+        }
+        for (auto group_id : groups) {
+            auto it = m_byGroup.find(group_id);
+            if (it == m_byGroup.end())
+                continue;
+            std::erase_if(it->second, [seq](const GroupEntry& entry) { return entry.location.segment == seq; });
+            if (it->second.empty())
+                m_byGroup.erase(it);
+        }
+
+        auto path = segment.path;
+        m_segments.pop_front();
+        ++m_firstSeq;
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        if (ec)
+            std::cerr << "Message Store Error: cannot remove " << path.string() << ": " << ec.message() << std::endl;
+    }
+
+    const MappedSegment* MessageStore::segment(uint64_t seq) const {
+        if (seq < m_firstSeq || seq - m_firstSeq >= m_segments.size())
+            return nullptr;
+        return m_segments[seq - m_firstSeq].get();
+    }
+
+    StoredMessage MessageStore::read(Location location) const {
+        auto data = segment(location.segment)->data() + location.offset;
+        RecordHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        return {
+            header.self_id,
+            header.message_id,
+            header.group_id,
+            header.user_id,
+            header.time,
+            std::string_view(data + sizeof(RecordHeader), header.size)
+        };
+    }
+
+    bool MessageStore::append(const EventJson& event, std::string_view raw) {
+        auto message_id = event.find("message_id");
+        if (message_id == event.end() || !message_id->is_number_integer() || raw.empty())
+            return false;
+        StoredMessage message{
+            event.value("self_id", uint64_t(0)),
+            message_id->get<int64_t>(),
+            event.value("group_id", uint64_t(0)),
+            event.value("user_id", uint64_t(0)),
+            event.value("time", int64_t(0)),
+            raw
+        };
+        auto length = _align(sizeof(RecordHeader) + raw.size());
+        if (raw.size() > UINT32_MAX || sizeof(MAGIC) + length > m_config.segment_size) {
+            std::cerr << "Message Store Error: message " << message.message_id << " is larger than a segment" << std::endl;
+            return false;
+        }
+
+        std::unique_lock lock(m_mtx);
+        // 重连重放或者多条连接上报的同一条消息只存一次
+        if (m_byId.contains({ message.self_id, message.message_id }))
+            return false;
+        if (m_writeOffset + length > m_segments.back()->size()) {
+            try {
+                rotate();
+            }
+            catch (const std::exception& e) {
+                // 磁盘写满等原因建不出新段时丢弃这条消息，之后的消息会再次尝试
+                std::cerr << "Message Store Error: " << e.what() << std::endl;
+                return false;
+            }
+        }
+        auto& segment = *m_segments.back();
+        auto data = segment.data() + m_writeOffset;
+        RecordHeader header{
+            0,
+            0,
+            message.self_id,
+            message.message_id,
+            message.group_id,
+            message.user_id,
+            message.time
+        };
+        std::memcpy(data + sizeof(RecordHeader), raw.data(), raw.size());
+        std::memcpy(data, &header, sizeof(header));
+        // size最后写入，进程中途退出时未写完的记录不会在重启后被扫描到
+        auto size = static_cast<uint32_t>(raw.size());
+        std::memcpy(data, &size, sizeof(size));
+
+        Location location{ segment.seq, m_writeOffset };
+        m_writeOffset += length;
+        segment.newest = std::max(segment.newest, message.time);
+        message.raw = std::string_view(data + sizeof(RecordHeader), raw.size());
+        index(message, location);
+        // 段很大时轮转可能要很久才发生一次，写入时顺便检查保留时间
+        retire();
+        return true;
+    }
+
+    bool MessageStore::find(uint64_t self_id, int64_t message_id, const std::function<void(const StoredMessage&)>& visitor) const {
+        std::shared_lock lock(m_mtx);
+        auto it = m_byId.find({ self_id, message_id });
+        if (it == m_byId.end())
+            return false;
+        visitor(read(it->second));
+        return true;
+    }
+
+    void MessageStore::scan(const std::function<void(const StoredMessage&)>& visitor) const {
+        std::shared_lock lock(m_mtx);
+        for (const auto& segment : m_segments) {
+            auto end = segment.get() == m_segments.back().get() ? m_writeOffset : segment->size();
+            uint64_t offset = sizeof(MAGIC);
+            while (offset + sizeof(RecordHeader) <= end) {
+                RecordHeader header;
+                std::memcpy(&header, segment->data() + offset, sizeof(header));
+                if (header.size == 0 || offset + sizeof(RecordHeader) + header.size > end)
+                    break;
+                visitor(read({ segment->seq, offset }));
+                offset += _align(sizeof(RecordHeader) + header.size);
+            }
+        }
+    }
+
+    std::size_t MessageStore::groupRange(uint64_t group_id, int64_t from, int64_t to, const std::function<bool(const StoredMessage&)>& visitor) const {
+        std::shared_lock lock(m_mtx);
+        auto it = m_byGroup.find(group_id);
+        if (it == m_byGroup.end())
+            return 0;
+        const auto& entries = it->second;
+        auto begin = std::lower_bound(entries.begin(), entries.end(), from, [](const GroupEntry& entry, int64_t time) {
+            return entry.time < time;
+        });
+        std::size_t visited = 0;
+        for (auto entry = begin; entry != entries.end() && entry->time <= to; ++entry) {
+            ++visited;
+            if (!visitor(read(entry->location)))
+                break;
+        }
+        return visited;
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "twobot.hh"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace twobot {
+    class MappedSegment;
+
+    // 消息的只追加存储，目录下按序号命名的段文件预分配固定大小并映射到内存，记录直接写进映射区
+    // 打开时顺序扫描已有的段重建索引：(self_id, message_id)到记录的位置，以及每个群按时间排序的记录列表
+    // 查询持有共享锁，直接在映射区上回调；段按段数和保留时间整体淘汰，写入时检查
+    // 段文件创建时预分配磁盘空间，磁盘写满时建段失败并报告，而不是在写映射区时收到SIGBUS
+    class MessageStore {
+    public:
+        explicit MessageStore(const MessageStoreConfig& config);
+        ~MessageStore();
+
+        // 记录一条消息事件，raw为上报的原始json；已经存过的message_id忽略，返回是否写入
+        bool append(const EventJson& event, std::string_view raw);
+
+        bool find(uint64_t self_id, int64_t message_id, const std::function<void(const StoredMessage&)>& visitor) const;
+        // 按写入顺序遍历所有记录
+        void scan(const std::function<void(const StoredMessage&)>& visitor) const;
+        std::size_t groupRange(uint64_t group_id, int64_t from, int64_t to, const std::function<bool(const StoredMessage&)>& visitor) const;
+
+    private:
+        struct Location {
+            uint64_t segment; // 段的序号
+            uint64_t offset;  // 记录头在段内的偏移
+        };
+
+        struct GroupEntry {
+            int64_t time;
+            Location location;
+        };
+
+        struct MessageKey {
+            uint64_t self_id;
+            int64_t message_id;
+
+            bool operator==(const MessageKey& other) const = default;
+        };
+
+        struct MessageKeyHash {
+            std::size_t operator()(const MessageKey& key) const {
+                return std::hash<uint64_t>()(key.self_id) ^ (std::hash<int64_t>()(key.message_id) << 1);
+            }
+        };
+
+        void openSegment(uint64_t seq);
+        // 扫描段内的记录建立索引，返回第一条空记录的偏移
+        uint64_t indexSegment(uint64_t seq);
+        void rotate();
+        // 按段数和保留时间删除最旧的段
+        void retire();
+        void dropOldest();
+        void index(const StoredMessage& message, Location location);
+        const MappedSegment* segment(uint64_t seq) const;
+        StoredMessage read(Location location) const;
+
+        MessageStoreConfig m_config;
+        std::filesystem::path m_dir;
+
+        mutable std::shared_mutex m_mtx;
+        std::deque<std::unique_ptr<MappedSegment>> m_segments; // 按序号递增
+        uint64_t m_firstSeq = 0;
+        uint64_t m_writeOffset = 0; // 最后一个段的写入位置
+        std::unordered_map<MessageKey, Location, MessageKeyHash> m_byId;
+        std::unordered_map<uint64_t, std::vector<GroupEntry>> m_byGroup;
+    };
+}
@@ -0,0 +1,103 @@
+#include "recall.hh"
+#include <algorithm>
+#include <cstring>
+
+namespace twobot {
+    RecallCache::RecallCache(const RecallCacheConfig& config)
+        : m_config(config)
+    {
+        m_config.messages = std::max<std::size_t>(m_config.messages, 1);
+        m_config.bytes = std::max<std::size_t>(m_config.bytes, 256);
+        m_config.conversations = std::max<std::size_t>(m_config.conversations, 1);
+    }
+
+    void RecallCache::record(const EventJson& message) {
+        auto message_id = message.find("message_id");
+        if (message_id == message.end() || !message_id->is_number_integer())
+            return;
+        auto group_id = message.value("group_id", uint64_t(0));
+        auto user_id = message.value("user_id", uint64_t(0));
+        Key key{ message.value("self_id", uint64_t(0)), group_id != 0 ? group_id : user_id, group_id != 0 };
+
+        // 数组格式的消息也带有raw_message
+        auto raw_message = message.find("raw_message");
+        if (raw_message == message.end() || !raw_message->is_string())
+            return;
+        const auto& content = raw_message->template get_ref<const EventJson::string_t&>();
+        if (content.size() > m_config.bytes)
+            return;
+        auto size = static_cast<uint32_t>(content.size());
+
+        std::lock_guard lock(m_mtx);
+        auto it = m_conversations.find(key);
+        if (it == m_conversations.end()) {
+            if (m_conversations.size() >= m_config.conversations) {
+                m_conversations.erase(m_lru.back().key);
+                m_lru.pop_back();
+            }
+            m_lru.push_front({ key, std::vector<Entry>(m_config.messages), 0, std::make_unique<char[]>(m_config.bytes), 0 });
+            it = m_conversations.emplace(key, m_lru.begin()).first;
+        }
+        else if (it->second != m_lru.begin()) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+        }
+        auto& conversation = *it->second;
+
+        // 放不下缓冲区末尾时从头开始，内容总是连续的
+        auto offset = conversation.head % m_config.bytes;
+        if (offset + size > m_config.bytes)
+            conversation.head += m_config.bytes - offset;
+        std::memcpy(conversation.bytes.get() + conversation.head % m_config.bytes, content.data(), size);
+        conversation.entries[conversation.next] = {
+            message_id->get<int64_t>(),
+            user_id,
+            message.value("time", int64_t(0)),
+            conversation.head,
+            size
+        };
+        conversation.head += size;
+        conversation.next = (conversation.next + 1) % conversation.entries.size();
+    }
+
+    bool RecallCache::attach(EventJson& notice) {
+        auto notice_type = notice.value("notice_type", "");
+        bool group = notice_type == "group_recall";
+        if (!group && notice_type != "friend_recall")
+            return false;
+        auto message_id = notice.value("message_id", int64_t(0));
+        auto time = notice.value("time", int64_t(0));
+        Key key{ notice.value("self_id", uint64_t(0)), notice.value(group ? "group_id" : "user_id", uint64_t(0)), group };
+
+        Event::RecalledMessage original;
+        {
+            std::lock_guard lock(m_mtx);
+            auto it = m_conversations.find(key);
+            if (it == m_conversations.end())
+                return false;
+            const auto& conversation = *it->second;
+            const auto count = conversation.entries.size();
+            const Entry* found = nullptr;
+            for (std::size_t i = 1; i <= count; ++i) {
+                const auto& entry = conversation.entries[(conversation.next + count - i) % count];
+                if (entry.message_id == message_id && entry.size > 0) {
+                    found = &entry;
+                    break;
+                }
+            }
+            // 内容已经被后来的消息覆盖，或者超出了保留时间
+            if (found == nullptr
+                || conversation.head - found->pos > m_config.bytes
+                || time - found->time > m_config.max_age.count())
+                return false;
+            original.user_id = found->user_id;
+            original.time = found->time;
+            original.message.assign(conversation.bytes.get() + found->pos % m_config.bytes, found->size);
+        }
+        notice["original"] = {
+            {"user_id", original.user_id},
+            {"time", original.time},
+            {"message", original.message}
+        };
+        return true;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "twobot.hh"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace twobot {
+    // 最近消息的缓存，撤回通知派发前按message_id找回原消息并写入事件的original字段
+    // 每个会话(群或好友)一个环：固定条数的索引加一块循环使用的字节缓冲区，消息内容连续拷贝进去，
+    // 旧内容被覆盖时对应的索引自然失效；记录一条消息只有一次拷贝，不做哈希表插入，查找时从新到旧线性扫描
+    class RecallCache {
+    public:
+        explicit RecallCache(const RecallCacheConfig& config);
+
+        // 记录一条私聊或群消息
+        void record(const EventJson& message);
+        // 撤回通知找到原消息时写入"original"，返回是否找到
+        bool attach(EventJson& notice);
+
+    private:
+        struct Key {
+            uint64_t self_id;
+            uint64_t peer; // 群号或好友QQ
+            bool group;
+
+            bool operator==(const Key& other) const = default;
+        };
+
+        struct KeyHash {
+            std::size_t operator()(const Key& key) const {
+                return std::hash<uint64_t>()(key.self_id) ^ (std::hash<uint64_t>()(key.peer) << 1) ^ key.group;
+            }
+        };
+
+        struct Entry {
+            int64_t message_id = 0;
+            uint64_t user_id = 0;
+            int64_t time = 0;
+            uint64_t pos = 0; // 内容在字节流中的绝对位置
+            uint32_t size = 0;
+        };
+
+        struct Conversation {
+            Key key;
+            std::vector<Entry> entries;
+            std::size_t next = 0;  // 下一个写入的索引
+            std::unique_ptr<char[]> bytes;
+            uint64_t head = 0;     // 已经写入的字节流长度
+        };
+
+        RecallCacheConfig m_config;
+        std::mutex m_mtx;
+        // 最近写入的会话在前，超出conversations时淘汰最久没有消息的会话
+        std::list<Conversation> m_lru;
+        std::unordered_map<Key, std::list<Conversation>::iterator, KeyHash> m_conversations;
+    };
+}
@@ -0,0 +1,150 @@
+#include "runtime.hh"
+#include "affinity.hh"
+
+namespace twobot {
+    namespace {
+        // TBB线程会在各通道之间迁移，每次进入通道时都限制到同一组CPU上，已经限制过的线程不再重复设置
+        class PinningObserver : public tbb::task_scheduler_observer {
+        public:
+            PinningObserver(tbb::task_arena& arena, std::vector<int> cpus)
+                : tbb::task_scheduler_observer(arena)
+                , m_cpus(std::move(cpus))
+            {
+                observe(true);
+            }
+
+            void on_scheduler_entry(bool) override {
+                thread_local bool pinned = false;
+                if (!pinned)
+                    pinned = pinCurrentThread(m_cpus);
+            }
+
+        private:
+            std::vector<int> m_cpus;
+        };
+
+        tbb::task_arena::priority _priority(LaneConfig::Priority priority) {
+            switch (priority) {
+            case LaneConfig::Priority::LOW:
+                return tbb::task_arena::priority::low;
+            case LaneConfig::Priority::HIGH:
+                return tbb::task_arena::priority::high;
+            default:
+                return tbb::task_arena::priority::normal;
+            }
+        }
+    }
+
+    Runtime::Impl::Impl(std::size_t io_threads, std::size_t worker_threads, const std::optional<LaneConfigs>& lane_configs, const Placement& placement)
+        : service(brynet::net::IOThreadTcpService::Create())
+        , pool(static_cast<BS::concurrency_t>(lane_configs.has_value() ? 1 : worker_threads), [cpus = placement.worker_cpus] {
+            pinCurrentThread(cpus);
+        })
+    {
+        if (lane_configs.has_value()) {
+            for (std::size_t i = 0; i < lanes.size(); ++i) {
+                const auto& lane = (*lane_configs)[i];
+                // 任务都是入队的，不需要给外部线程保留槽位
+                lanes[i] = std::make_unique<tbb::task_arena>(
+                    tbb::task_arena::constraints(placement.numa_node, lane.concurrency > 0 ? lane.concurrency : tbb::task_arena::automatic),
+                    0,
+                    _priority(lane.priority)
+                );
+                if (!placement.worker_cpus.empty())
+                    observers.push_back(std::make_unique<PinningObserver>(*lanes[i], placement.worker_cpus));
+            }
+        }
+        // IO线程在第一次循环时按启动顺序依次绑定
+        if (placement.io_cpus.empty()) {
+            service->startWorkerThread(io_threads);
+        }
+        else {
+            auto next = std::make_shared<std::atomic<std::size_t>>(0);
+            service->startWorkerThread(io_threads, [next, cpus = placement.io_cpus](const brynet::net::EventLoop::Ptr&) {
+                thread_local bool pinned = false;
+                if (pinned)
+                    return;
+                pinned = true;
+                pinCurrentThread({ cpus[(*next)++ % cpus.size()] });
+            });
+        }
+    }
+
+    Runtime::Impl::~Impl() {
+        // 先停IO，保证不会再有新任务进入线程池
+        if (m_connector)
+            m_connector->stopWorkerThread();
+        service->stopWorkerThread();
+        if (m_http)
+            m_http->wait();
+        pool.wait();
+        std::unique_lock lock(m_laneMtx);
+        m_laneCv.wait(lock, [this] { return m_laneTasks == 0; });
+    }
+
+    void Runtime::Impl::submit(Lane lane, Job job) {
+        auto& arena = lanes[static_cast<std::size_t>(lane)];
+        if (!arena) {
+            pool.detach_task(std::move(job));
+            return;
+        }
+        ++m_laneTasks;
+        arena->enqueue([this, job = std::move(job)] {
+            job();
+            if (--m_laneTasks == 0) {
+                std::lock_guard lock(m_laneMtx);
+                m_laneCv.notify_all();
+            }
+        });
+    }
+
+    brynet::net::AsyncConnector::Ptr Runtime::Impl::connector() {
+        std::lock_guard lock(m_mtx);
+        if (!m_connector) {
+            m_connector = brynet::net::AsyncConnector::Create();
+            m_connector->startWorkerThread();
+        }
+        return m_connector;
+    }
+
+    void Runtime::Impl::submitHttp(Job job) {
+        std::unique_lock lock(m_mtx);
+        if (!m_http)
+            m_http = std::make_unique<BS::thread_pool>(static_cast<BS::concurrency_t>(HTTP_THREADS));
+        lock.unlock();
+        m_http->detach_task(std::move(job));
+    }
+
+    // 执行器通过它找到运行时，不持有Impl，Impl总是在释放Runtime的线程上析构，不会落到自己的工作线程上
+    struct Runtime::Gate {
+        std::shared_mutex mtx;
+        Impl* impl = nullptr;
+    };
+
+    std::shared_ptr<Runtime> Runtime::create(std::size_t io_threads, std::size_t worker_threads, std::optional<LaneConfigs> lanes, Placement placement) {
+        return std::shared_ptr<Runtime>(new Runtime(std::make_unique<Impl>(io_threads, worker_threads, lanes, placement)));
+    }
+
+    Runtime::Runtime(std::unique_ptr<Impl> impl)
+        : m_impl(std::move(impl))
+        , m_gate(std::make_shared<Gate>())
+    {
+        m_gate->impl = m_impl.get();
+    }
+
+    Runtime::~Runtime() {
+        {
+            std::unique_lock lock(m_gate->mtx);
+            m_gate->impl = nullptr;
+        }
+        m_impl.reset();
+    }
+
+    Executor Runtime::executor(Lane lane) {
+        return [gate = m_gate, lane](Job job) {
+            std::shared_lock lock(gate->mtx);
+            if (gate->impl)
+                gate->impl->submit(lane, std::move(job));
+        };
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "twobot.hh"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <brynet/net/AsyncConnector.hpp>
+#include <brynet/net/TcpService.hpp>
+#include <BS_thread_pool.hpp>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+#include <vector>
+
+namespace twobot {
+    struct Runtime::Impl {
+        Impl(std::size_t io_threads, std::size_t worker_threads, const std::optional<LaneConfigs>& lanes, const Placement& placement);
+        ~Impl();
+
+        void submit(Lane lane, Job job);
+
+        // 正向WS用的连接器，第一次使用时才启动
+        brynet::net::AsyncConnector::Ptr connector();
+        // 同步模式的HTTP请求在单独的线程中阻塞，不占用事件线程池，处理函数在事件线程上等待结果时不会死锁；第一次使用时才启动
+        void submitHttp(Job job);
+
+        static constexpr std::size_t HTTP_THREADS = 8;
+
+        brynet::net::IOThreadTcpService::Ptr service;
+        BS::thread_pool pool;
+        // 配置了通道时每个通道一个task_arena，此时pool不再使用
+        std::array<std::unique_ptr<tbb::task_arena>, 4> lanes{};
+        // 进入各通道的TBB线程按Placement绑定CPU，必须先于lanes析构
+        std::vector<std::unique_ptr<tbb::task_scheduler_observer>> observers{};
+
+    private:
+        std::mutex m_mtx;
+        brynet::net::AsyncConnector::Ptr m_connector;
+        std::unique_ptr<BS::thread_pool> m_http;
+
+        // task_arena没有等待已入队任务的接口，自己计数
+        std::atomic<std::size_t> m_laneTasks = 0;
+        std::mutex m_laneMtx;
+        std::condition_variable m_laneCv;
+    };
+}
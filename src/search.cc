@@ -0,0 +1,502 @@
+#include "search.hh"
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+
+namespace twobot {
+    namespace {
+        enum class CharKind {
+            SEPARATOR,
+            WORD, // 按空白和标点切分的文字
+            CJK,  // 中日韩文字，逐字切分
+        };
+
+        // 解码一个UTF-8字符，非法字节按U+FFFD跳过一个字节
+        uint32_t _decode(std::string_view text, std::size_t& i) {
+            auto c = static_cast<unsigned char>(text[i]);
+            int length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+            if (length == 0 || i + length > text.size()) {
+                ++i;
+                return 0xFFFD;
+            }
+            uint32_t cp = length == 1 ? c : c & (0x7F >> length);
+            for (int k = 1; k < length; ++k) {
+                auto next = static_cast<unsigned char>(text[i + k]);
+                if ((next & 0xC0) != 0x80) {
+                    ++i;
+                    return 0xFFFD;
+                }
+                cp = (cp << 6) | (next & 0x3F);
+            }
+            i += length;
+            return cp;
+        }
+
+        void _encode(std::string& out, uint32_t cp) {
+            if (cp < 0x80) {
+                out += static_cast<char>(cp);
+            }
+            else if (cp < 0x800) {
+                out += static_cast<char>(0xC0 | (cp >> 6));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else if (cp < 0x10000) {
+                out += static_cast<char>(0xE0 | (cp >> 12));
+                out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else {
+                out += static_cast<char>(0xF0 | (cp >> 18));
+                out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+        }
+
+        // 全角字母数字折叠为半角，ASCII字母转为小写
+        CharKind _classify(uint32_t& cp) {
+            if (cp >= 0xFF01 && cp <= 0xFF5E)
+                cp -= 0xFEE0;
+            if (cp < 0x80) {
+                if (cp >= 'A' && cp <= 'Z')
+                    cp += 'a' - 'A';
+                return (cp >= 'a' && cp <= 'z') || (cp >= '0' && cp <= '9') ? CharKind::WORD : CharKind::SEPARATOR;
+            }
+            if ((cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0x3400 && cp <= 0x4DBF) || (cp >= 0xF900 && cp <= 0xFAFF)
+                || (cp >= 0x20000 && cp <= 0x2FA1F)
+                || (cp >= 0x3040 && cp <= 0x30FF)  // 平假名、片假名
+                || (cp >= 0xAC00 && cp <= 0xD7AF)) // 谚文
+                return CharKind::CJK;
+            if ((cp >= 0xC0 && cp <= 0x24F && cp != 0xD7 && cp != 0xF7) // 拉丁字母扩展
+                || (cp >= 0x370 && cp <= 0x4FF))                      // 希腊字母、西里尔字母
+                return CharKind::WORD;
+            return CharKind::SEPARATOR;
+        }
+
+        using Tokens = std::vector<std::pair<std::string, uint16_t>>;
+
+        // 每个词附带位置，文档中的单字与以它开头的两字词位置相同
+        Tokens _tokenize(std::string_view text, bool query) {
+            Tokens tokens;
+            uint32_t pos = 0;
+            std::string word;
+            std::vector<std::string> run;
+            auto flush = [&] {
+                if (!word.empty() && pos <= UINT16_MAX)
+                    tokens.emplace_back(std::move(word), static_cast<uint16_t>(pos++));
+                word.clear();
+                // 查询中两字以上的片段只用两字词，单字只在文档中索引
+                for (std::size_t i = 0; i < run.size() && pos + i <= UINT16_MAX; ++i) {
+                    auto at = static_cast<uint16_t>(pos + i);
+                    if (!query || run.size() == 1)
+                        tokens.emplace_back(run[i], at);
+                    if (i + 1 < run.size())
+                        tokens.emplace_back(run[i] + run[i + 1], at);
+                }
+                pos += static_cast<uint32_t>(run.size());
+                run.clear();
+            };
+            for (std::size_t i = 0; i < text.size();) {
+                auto cp = _decode(text, i);
+                auto kind = _classify(cp);
+                if (kind == CharKind::WORD) {
+                    if (!run.empty())
+                        flush();
+                    _encode(word, cp);
+                }
+                else if (kind == CharKind::CJK) {
+                    if (!word.empty())
+                        flush();
+                    std::string c;
+                    _encode(c, cp);
+                    run.push_back(std::move(c));
+                }
+                else {
+                    flush();
+                }
+            }
+            flush();
+            return tokens;
+        }
+
+        // 查询由OR分隔的若干子句组成，子句内的条件都要满足；条件是一个词或者引号内的短语，以-开头表示排除
+        struct Atom {
+            Tokens tokens;
+            bool negate = false;
+        };
+        using Clause = std::vector<Atom>;
+
+        std::vector<Clause> _parse(std::string_view text) {
+            std::vector<Clause> clauses(1);
+            std::size_t i = 0;
+            while (i < text.size()) {
+                if (text[i] == ' ' || text[i] == '\t' || text[i] == '\n') {
+                    ++i;
+                    continue;
+                }
+                bool negate = false;
+                if (text[i] == '-' && i + 1 < text.size() && text[i + 1] != ' ') {
+                    negate = true;
+                    ++i;
+                }
+                std::string_view atom;
+                if (text[i] == '"') {
+                    auto end = text.find('"', i + 1);
+                    if (end == std::string_view::npos)
+                        end = text.size();
+                    atom = text.substr(i + 1, end - i - 1);
+                    i = std::min(end + 1, text.size());
+                }
+                else {
+                    auto end = text.find_first_of(" \t\n", i);
+                    if (end == std::string_view::npos)
+                        end = text.size();
+                    atom = text.substr(i, end - i);
+                    i = end;
+                    if (!negate && atom == "OR") {
+                        clauses.emplace_back();
+                        continue;
+                    }
+                }
+                auto tokens = _tokenize(atom, true);
+                if (!tokens.empty())
+                    clauses.back().push_back({ std::move(tokens), negate });
+            }
+            return clauses;
+        }
+
+        std::vector<uint32_t> _intersect(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+            std::vector<uint32_t> out;
+            std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+            return out;
+        }
+
+        std::vector<uint32_t> _subtract(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+            std::vector<uint32_t> out;
+            std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+            return out;
+        }
+
+        std::vector<uint32_t> _union(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+            std::vector<uint32_t> out;
+            std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+            return out;
+        }
+    }
+
+    SearchIndex::SearchIndex(const SearchConfig& config)
+        : m_config(config)
+    {
+        m_config.batch = std::max<std::size_t>(m_config.batch, 1);
+    }
+
+    void SearchIndex::setExecutor(Executor executor) {
+        std::unique_lock lock(m_mtx);
+        m_executor = std::move(executor);
+    }
+
+    std::string SearchIndex::stripCQ(std::string_view raw_message) {
+        std::string text;
+        text.reserve(raw_message.size());
+        std::size_t i = 0;
+        while (i < raw_message.size()) {
+            if (raw_message.compare(i, 4, "[CQ:") == 0) {
+                auto end = raw_message.find(']', i);
+                if (end == std::string_view::npos)
+                    break;
+                // CQ码两侧的文字不能连成一个词
+                text += ' ';
+                i = end + 1;
+                continue;
+            }
+            if (raw_message[i] == '&') {
+                constexpr std::pair<std::string_view, char> escapes[] = {
+                    { "&amp;", '&' }, { "&#91;", '[' }, { "&#93;", ']' }, { "&#44;", ',' }
+                };
+                bool matched = false;
+                for (auto [escape, c] : escapes) {
+                    if (raw_message.compare(i, escape.size(), escape) == 0) {
+                        text += c;
+                        i += escape.size();
+                        matched = true;
+                        break;
+                    }
+                }
+                if (matched)
+                    continue;
+            }
+            text += raw_message[i++];
+        }
+        return text;
+    }
+
+    const SearchIndex::Postings* SearchIndex::Segment::find(std::string_view term) const {
+        auto it = std::lower_bound(terms.begin(), terms.end(), term);
+        if (it == terms.end() || *it != term)
+            return nullptr;
+        return &postings[it - terms.begin()];
+    }
+
+    void SearchIndex::add(const EventJson& message) {
+        auto message_id = message.find("message_id");
+        auto raw_message = message.find("raw_message");
+        if (message_id == message.end() || !message_id->is_number_integer()
+            || raw_message == message.end() || !raw_message->is_string())
+            return;
+        const auto& raw = raw_message->template get_ref<const EventJson::string_t&>();
+        index({
+            message.value("self_id", uint64_t(0)),
+            message_id->get<int64_t>(),
+            message.value("group_id", uint64_t(0)),
+            message.value("user_id", uint64_t(0)),
+            message.value("time", int64_t(0))
+        }, std::string_view(raw.data(), raw.size()));
+    }
+
+    void SearchIndex::index(const Doc& doc, std::string_view raw_message) {
+        // 分词不持锁
+        auto tokens = _tokenize(stripCQ(raw_message), false);
+        bool merge_inline = false;
+        {
+            std::unique_lock lock(m_mtx);
+            if (!m_keys.insert({ doc.self_id, doc.message_id }).second)
+                return;
+            auto id = m_firstDoc + static_cast<uint32_t>(m_docs.size());
+            m_docs.push_back(doc);
+            if (m_buffer.doc_count == 0)
+                m_buffer.first_doc = id;
+            ++m_buffer.doc_count;
+            for (auto& [term, pos] : tokens) {
+                auto& postings = m_buffer.postings[term];
+                if (postings.docs.empty() || postings.docs.back() != id) {
+                    postings.docs.push_back(id);
+                    postings.offsets.push_back(postings.offsets.back());
+                }
+                postings.positions.push_back(pos);
+                ++postings.offsets.back();
+            }
+            if (m_buffer.doc_count < m_config.batch)
+                return;
+            freeze();
+            if (m_merging || mergeCandidate() < 0)
+                return;
+            m_merging = true;
+            if (m_executor)
+                m_executor([this] { mergeAll(); });
+            else
+                merge_inline = true;
+        }
+        if (merge_inline)
+            mergeAll();
+    }
+
+    void SearchIndex::freeze() {
+        auto segment = std::make_shared<Segment>();
+        segment->first_doc = m_buffer.first_doc;
+        segment->doc_count = m_buffer.doc_count;
+        std::vector<std::pair<std::string, Postings>> entries(
+            std::make_move_iterator(m_buffer.postings.begin()),
+            std::make_move_iterator(m_buffer.postings.end()));
+        std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        segment->terms.reserve(entries.size());
+        segment->postings.reserve(entries.size());
+        for (auto& [term, postings] : entries) {
+            postings.docs.shrink_to_fit();
+            postings.offsets.shrink_to_fit();
+            postings.positions.shrink_to_fit();
+            segment->terms.push_back(term);
+            segment->postings.push_back(std::move(postings));
+        }
+        m_segments.push_back(std::move(segment));
+        m_buffer = Buffer{};
+        prune();
+    }
+
+    void SearchIndex::prune() {
+        if (m_config.retention.count() <= 0)
+            return;
+        auto cutoff = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch() - m_config.retention).count();
+        // 消息基本按时间顺序到达，从最旧的开始淘汰，遇到未过期的就停止
+        while (!m_docs.empty() && m_docs.front().time < cutoff) {
+            m_keys.erase({ m_docs.front().self_id, m_docs.front().message_id });
+            m_docs.pop_front();
+            ++m_firstDoc;
+        }
+        // 合并期间段的下标不能变化，整段过期的留到下次
+        if (m_merging)
+            return;
+        std::erase_if(m_segments, [this](const SegmentPtr& segment) {
+            return segment->first_doc + segment->doc_count <= m_firstDoc;
+        });
+    }
+
+    int SearchIndex::mergeCandidate() const {
+        // 较旧的段不超过较新的段两倍时合并，段的大小从旧到新大致按几何级数递减
+        for (auto i = static_cast<int>(m_segments.size()) - 2; i >= 0; --i) {
+            if (m_segments[i]->doc_count <= m_segments[i + 1]->doc_count * 2)
+                return i;
+        }
+        return -1;
+    }
+
+    void SearchIndex::mergeAll() {
+        for (;;) {
+            SegmentPtr older, newer;
+            uint32_t first_live;
+            {
+                std::unique_lock lock(m_mtx);
+                auto i = mergeCandidate();
+                if (i < 0) {
+                    m_merging = false;
+                    return;
+                }
+                older = m_segments[i];
+                newer = m_segments[i + 1];
+                first_live = m_firstDoc;
+            }
+            auto merged = merge(*older, *newer, first_live);
+            std::unique_lock lock(m_mtx);
+            // 合并期间只会在末尾追加新段，两段的位置不变
+            auto it = std::find(m_segments.begin(), m_segments.end(), older);
+            *it = std::move(merged);
+            m_segments.erase(it + 1);
+        }
+    }
+
+    SearchIndex::SegmentPtr SearchIndex::merge(const Segment& older, const Segment& newer, uint32_t first_live) const {
+        auto segment = std::make_shared<Segment>();
+        segment->first_doc = older.first_doc;
+        segment->doc_count = newer.first_doc + newer.doc_count - older.first_doc;
+
+        // 旧段的文档号都小于新段，同一个词的倒排表直接拼接，顺便丢掉过期的文档
+        auto append = [first_live](Postings& out, const Postings& in) {
+            auto begin = std::lower_bound(in.docs.begin(), in.docs.end(), first_live) - in.docs.begin();
+            for (auto k = static_cast<std::size_t>(begin); k < in.docs.size(); ++k) {
+                out.docs.push_back(in.docs[k]);
+                out.positions.insert(out.positions.end(), in.positions.begin() + in.offsets[k], in.positions.begin() + in.offsets[k + 1]);
+                out.offsets.push_back(static_cast<uint32_t>(out.positions.size()));
+            }
+        };
+
+        std::size_t a = 0, b = 0;
+        while (a < older.terms.size() || b < newer.terms.size()) {
+            Postings postings;
+            std::string term;
+            if (b == newer.terms.size() || (a < older.terms.size() && older.terms[a] < newer.terms[b])) {
+                term = older.terms[a];
+                append(postings, older.postings[a++]);
+            }
+            else if (a == older.terms.size() || newer.terms[b] < older.terms[a]) {
+                term = newer.terms[b];
+                append(postings, newer.postings[b++]);
+            }
+            else {
+                term = older.terms[a];
+                append(postings, older.postings[a++]);
+                append(postings, newer.postings[b++]);
+            }
+            if (postings.docs.empty())
+                continue;
+            segment->terms.push_back(std::move(term));
+            segment->postings.push_back(std::move(postings));
+        }
+        return segment;
+    }
+
+    namespace {
+        // 在一个段里求值，lookup按词查倒排表
+        template<typename Lookup>
+        std::vector<uint32_t> _evaluate(const std::vector<Clause>& clauses, const Lookup& lookup) {
+            auto atom_docs = [&](const Atom& atom) {
+                std::vector<decltype(lookup(std::string_view()))> lists;
+                for (const auto& [term, pos] : atom.tokens) {
+                    auto postings = lookup(term);
+                    if (postings == nullptr)
+                        return std::vector<uint32_t>{};
+                    lists.push_back(postings);
+                }
+                auto docs = lists[0]->docs;
+                for (std::size_t i = 1; i < lists.size(); ++i)
+                    docs = _intersect(docs, lists[i]->docs);
+                if (lists.size() == 1)
+                    return docs;
+                // 短语：每个词在文档中的位置与第一个词的位置差和查询中一致
+                std::vector<uint32_t> matched;
+                for (auto doc : docs) {
+                    auto positions = [&](std::size_t i) {
+                        const auto& postings = *lists[i];
+                        auto k = std::lower_bound(postings.docs.begin(), postings.docs.end(), doc) - postings.docs.begin();
+                        return std::make_pair(postings.positions.begin() + postings.offsets[k], postings.positions.begin() + postings.offsets[k + 1]);
+                    };
+                    auto [first, last] = positions(0);
+                    bool found = false;
+                    for (auto p = first; p != last && !found; ++p) {
+                        found = true;
+                        for (std::size_t i = 1; i < lists.size() && found; ++i) {
+                            auto want = *p + atom.tokens[i].second - atom.tokens[0].second;
+                            auto [begin, end] = positions(i);
+                            found = std::binary_search(begin, end, static_cast<uint16_t>(want));
+                        }
+                    }
+                    if (found)
+                        matched.push_back(doc);
+                }
+                return matched;
+            };
+
+            std::vector<uint32_t> result;
+            for (const auto& clause : clauses) {
+                std::optional<std::vector<uint32_t>> docs;
+                for (const auto& atom : clause) {
+                    if (!atom.negate)
+                        docs = docs.has_value() ? _intersect(*docs, atom_docs(atom)) : atom_docs(atom);
+                }
+                // 只有排除条件的子句不匹配任何消息
+                if (!docs.has_value())
+                    continue;
+                for (const auto& atom : clause) {
+                    if (atom.negate)
+                        docs = _subtract(*docs, atom_docs(atom));
+                }
+                result = _union(result, *docs);
+            }
+            return result;
+        }
+    }
+
+    std::vector<SearchHit> SearchIndex::search(const SearchQuery& query) const {
+        auto clauses = _parse(query.text);
+        std::vector<SegmentPtr> segments;
+        std::vector<uint32_t> docs;
+        {
+            std::shared_lock lock(m_mtx);
+            segments = m_segments;
+            docs = _evaluate(clauses, [this](std::string_view term) -> const Postings* {
+                auto it = m_buffer.postings.find(std::string(term));
+                return it == m_buffer.postings.end() ? nullptr : &it->second;
+            });
+        }
+        // 各段的文档号互不重叠且从旧到新递增，结果直接拼接
+        std::vector<uint32_t> matched;
+        for (const auto& segment : segments) {
+            auto part = _evaluate(clauses, [&segment](std::string_view term) { return segment->find(term); });
+            matched.insert(matched.end(), part.begin(), part.end());
+        }
+        matched.insert(matched.end(), docs.begin(), docs.end());
+
+        std::unordered_set<uint64_t> groups(query.group_ids.begin(), query.group_ids.end());
+        std::vector<SearchHit> hits;
+        std::shared_lock lock(m_mtx);
+        for (auto it = matched.rbegin(); it != matched.rend() && hits.size() < query.limit; ++it) {
+            if (*it < m_firstDoc)
+                break;
+            const auto& doc = m_docs[*it - m_firstDoc];
+            if (doc.time < query.from || doc.time > query.to)
+                continue;
+            if (!groups.empty() && !groups.contains(doc.group_id))
+                continue;
+            hits.push_back({ doc.self_id, doc.message_id, doc.group_id, doc.user_id, doc.time });
+        }
+        return hits;
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include "twobot.hh"
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace twobot {
+    // 消息的倒排索引，raw_message去掉CQ码后分词：ASCII字母数字按词，中日韩文字按单字加相邻两字，位置连续，可以做短语匹配
+    // 新消息先进入可写的缓冲段，满batch条后冻结为按词排序的只读段，相邻的段按大小逐级合并(类似二进制进位)，
+    // 合并在执行器上进行，查询先在锁内取得各段的快照，之后不持锁
+    class SearchIndex {
+    public:
+        explicit SearchIndex(const SearchConfig& config);
+
+        // 合并任务投递到executor，没有设置时在写入线程上合并
+        void setExecutor(Executor executor);
+
+        // 索引一条消息事件，已经在索引中的(self_id, message_id)忽略
+        void add(const EventJson& message);
+
+        std::vector<SearchHit> search(const SearchQuery& query) const;
+
+        // 去掉CQ码并还原转义字符
+        static std::string stripCQ(std::string_view raw_message);
+
+    private:
+        struct Postings {
+            std::vector<uint32_t> docs;         // 递增的文档号
+            std::vector<uint32_t> offsets{ 0 }; // docs[i]的位置在positions[offsets[i], offsets[i + 1])
+            std::vector<uint16_t> positions;
+        };
+
+        // 冻结的只读段，terms按字典序排列
+        struct Segment {
+            std::vector<std::string> terms;
+            std::vector<Postings> postings;
+            uint32_t first_doc = 0; // 段内最小的文档号
+            uint32_t doc_count = 0;
+
+            const Postings* find(std::string_view term) const;
+        };
+
+        struct Buffer {
+            std::unordered_map<std::string, Postings> postings;
+            uint32_t first_doc = 0;
+            uint32_t doc_count = 0;
+        };
+
+        struct Doc {
+            uint64_t self_id;
+            int64_t message_id;
+            uint64_t group_id;
+            uint64_t user_id;
+            int64_t time;
+        };
+
+        struct DocKey {
+            uint64_t self_id;
+            int64_t message_id;
+
+            bool operator==(const DocKey& other) const = default;
+        };
+
+        struct DocKeyHash {
+            std::size_t operator()(const DocKey& key) const {
+                return std::hash<uint64_t>()(key.self_id) ^ (std::hash<int64_t>()(key.message_id) << 1);
+            }
+        };
+
+        using SegmentPtr = std::shared_ptr<const Segment>;
+
+        void index(const Doc& doc, std::string_view text);
+        void freeze();
+        // 按大小挑出需要合并的相邻两段，返回第一段的下标，没有时返回-1
+        int mergeCandidate() const;
+        void mergeAll();
+        SegmentPtr merge(const Segment& older, const Segment& newer, uint32_t first_live) const;
+        void prune();
+
+        SearchConfig m_config;
+        Executor m_executor{};
+
+        mutable std::shared_mutex m_mtx;
+        std::deque<Doc> m_docs; // 文档号从m_firstDoc开始
+        uint32_t m_firstDoc = 0;
+        std::unordered_set<DocKey, DocKeyHash> m_keys; // m_docs中的消息，重连重放的同一条消息只索引一次
+        std::vector<SegmentPtr> m_segments; // 从旧到新
+        Buffer m_buffer;
+        bool m_merging = false;
+    };
+}
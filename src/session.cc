@@ -0,0 +1,148 @@
+#include "session.hh"
+
+namespace twobot {
+    SessionRegistry::SessionRegistry(std::size_t queue_limit, std::chrono::milliseconds queue_timeout, PendingCalls& pending)
+        : m_queueLimit(queue_limit)
+        , m_queueTimeout(queue_timeout)
+        , m_pending(pending)
+    {
+
+    }
+
+    std::string SessionRegistry::buildFrame(const std::string& payload, const Entry& entry) {
+        using brynet::net::http::WebSocketFormat;
+        if (entry.deflate && entry.deflate->shouldCompress(payload))
+            return buildTextFrame(entry.deflate->compress(payload), entry.masking, true);
+        return WebSocketFormat::wsFrameBuild(payload, WebSocketFormat::WebSocketFrameType::TEXT_FRAME, true, entry.masking);
+    }
+
+    void SessionRegistry::connect(uint64_t id, const SessionPtr& session, bool is_client, std::shared_ptr<PerMessageDeflate> deflate) {
+        std::vector<std::size_t> expired;
+        {
+            std::lock_guard lock(m_mtx);
+            auto& entry = m_entries[id];
+            if (entry.session && entry.session != session)
+                m_owners.erase(entry.session.get());
+            entry.session = session;
+            entry.state = ConnState::CONNECTED;
+            entry.masking = is_client;
+            entry.deflate = std::move(deflate);
+            m_owners[session.get()] = id;
+            // 在锁内补发，保证队列中的帧先于新的发送；等待太久的调用不再发送
+            auto deadline = Clock::now() - m_queueTimeout;
+            while (!entry.pending.empty()) {
+                auto& queued = entry.pending.front();
+                if (queued.queued < deadline) {
+                    if (queued.seq)
+                        expired.push_back(*queued.seq);
+                }
+                else {
+                    session->send(buildFrame(queued.payload, entry));
+                    if (queued.seq)
+                        m_pending.bind(*queued.seq, session.get());
+                }
+                entry.pending.pop_front();
+            }
+        }
+        for (auto seq : expired)
+            m_pending.fail(seq, "send queue timed out");
+    }
+
+    void SessionRegistry::disconnect(const SessionPtr& session) {
+        {
+            std::lock_guard lock(m_mtx);
+            auto owner = m_owners.find(session.get());
+            if (owner == m_owners.end())
+                return;
+            auto& entry = m_entries[owner->second];
+            entry.session = nullptr;
+            entry.deflate = nullptr;
+            entry.state = ConnState::RECONNECTING;
+            entry.disconnected = Clock::now();
+            m_owners.erase(owner);
+        }
+        // 发出的帧都在锁内与会话关联，解锁后不会再有新的调用关联到这个会话
+        m_pending.failSession(session.get(), "session closed before response");
+    }
+
+    void SessionRegistry::remove(uint64_t id) {
+        std::vector<std::size_t> dropped;
+        {
+            std::lock_guard lock(m_mtx);
+            auto it = m_entries.find(id);
+            if (it == m_entries.end())
+                return;
+            if (it->second.session)
+                m_owners.erase(it->second.session.get());
+            for (auto& queued : it->second.pending) {
+                if (queued.seq)
+                    dropped.push_back(*queued.seq);
+            }
+            m_entries.erase(it);
+        }
+        for (auto seq : dropped)
+            m_pending.fail(seq, "bot removed");
+    }
+
+    void SessionRegistry::closeAll() {
+        std::lock_guard lock(m_mtx);
+        for (auto& [id, entry] : m_entries) {
+            if (entry.session)
+                entry.session->postClose();
+        }
+        m_entries.clear();
+        m_owners.clear();
+    }
+
+    SessionRegistry::SendStatus SessionRegistry::send(uint64_t id, std::string payload, std::optional<std::size_t> seq) {
+        std::lock_guard lock(m_mtx);
+        auto it = m_entries.find(id);
+        if (it == m_entries.end())
+            return SendStatus::UNKNOWN;
+        auto& entry = it->second;
+        if (entry.state == ConnState::CONNECTED) {
+            entry.session->send(buildFrame(payload, entry));
+            if (seq)
+                m_pending.bind(*seq, entry.session.get());
+            return SendStatus::SENT;
+        }
+        if (entry.pending.size() >= m_queueLimit)
+            return SendStatus::QUEUE_FULL;
+        entry.pending.push_back({ std::move(payload), seq, Clock::now() });
+        return SendStatus::QUEUED;
+    }
+
+    void SessionRegistry::expire() {
+        std::vector<std::size_t> expired;
+        {
+            std::lock_guard lock(m_mtx);
+            auto deadline = Clock::now() - m_queueTimeout;
+            for (auto it = m_entries.begin(); it != m_entries.end();) {
+                auto& entry = it->second;
+                if (entry.state != ConnState::RECONNECTING) {
+                    ++it;
+                    continue;
+                }
+                // 超时未重连的机器人连同队列一起移除，否则队列按时间排列，只需要看队首
+                bool gone = entry.disconnected < deadline;
+                while (!entry.pending.empty() && (gone || entry.pending.front().queued < deadline)) {
+                    if (entry.pending.front().seq)
+                        expired.push_back(*entry.pending.front().seq);
+                    entry.pending.pop_front();
+                }
+                if (gone)
+                    it = m_entries.erase(it);
+                else
+                    ++it;
+            }
+        }
+        for (auto seq : expired)
+            m_pending.fail(seq, "send queue timed out");
+    }
+
+    ConnState SessionRegistry::state(uint64_t id) const {
+        std::lock_guard lock(m_mtx);
+        auto it = m_entries.find(id);
+        return it == m_entries.end() ? ConnState::DISCONNECTED : it->second.state;
+    }
+}
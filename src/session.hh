@@ -0,0 +1,76 @@
+#pragma once
+#include "twobot.hh"
+#include "deflate.hh"
+#include "transport.hh"
+#include <chrono>
+#include <optional>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <brynet/net/http/HttpService.hpp>
+
+namespace twobot {
+    // 机器人QQ到WS会话(反向WS或正向WS客户端)的映射，归属于某个BotInstance
+    // 会话断开后进入RECONNECTING状态，此时的发送进入有界队列，重连后按顺序补发；
+    // 已经从断开的会话发出的调用不会再有响应，立即以失败结束；排队超过queue_timeout的调用也以失败结束，
+    // 超过queue_timeout仍未重连的机器人被移除
+    class SessionRegistry {
+    public:
+        using SessionPtr = brynet::net::http::HttpSession::Ptr;
+
+        enum class SendStatus {
+            SENT,     // 已交给会话发送
+            QUEUED,   // 正在重连，已进入队列
+            UNKNOWN,  // 机器人从未连接
+            QUEUE_FULL, // 重连队列已满
+        };
+
+        SessionRegistry(std::size_t queue_limit, std::chrono::milliseconds queue_timeout, PendingCalls& pending);
+
+        // 收到连接事件时调用，绑定会话并补发队列中的消息
+        // is_client为true表示会话是我们主动发起的正向WS连接，按协议要求发送的帧需要掩码
+        // deflate为握手协商出的压缩上下文，之后发往该会话的消息按需压缩
+        void connect(uint64_t id, const SessionPtr& session, bool is_client = false, std::shared_ptr<PerMessageDeflate> deflate = nullptr);
+        // 会话关闭时调用，只有仍然绑定在该会话上的机器人会进入RECONNECTING
+        void disconnect(const SessionPtr& session);
+        // 彻底移除机器人，队列中等待响应的调用以失败结束
+        void remove(uint64_t id);
+        // 关闭所有会话并丢弃队列，实例停止时调用
+        void closeAll();
+
+        // 发送一条文本消息，由会话决定是否掩码后封帧；seq为等待响应的调用，发出后与会话关联
+        SendStatus send(uint64_t id, std::string payload, std::optional<std::size_t> seq = std::nullopt);
+        // 清理排队超时的帧和长时间未重连的机器人，定期调用
+        void expire();
+        ConnState state(uint64_t id) const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Queued {
+            std::string payload;
+            std::optional<std::size_t> seq;
+            Clock::time_point queued;
+        };
+
+        struct Entry {
+            SessionPtr session;
+            ConnState state = ConnState::DISCONNECTED;
+            bool masking = false;
+            std::shared_ptr<PerMessageDeflate> deflate{};
+            std::deque<Queued> pending{};
+            Clock::time_point disconnected{};
+        };
+
+        // 压缩上下文在前后消息间共享，必须在锁内按发送顺序压缩
+        static std::string buildFrame(const std::string& payload, const Entry& entry);
+
+        mutable std::mutex m_mtx;
+        std::unordered_map<uint64_t, Entry> m_entries;
+        std::unordered_map<const void*, uint64_t> m_owners;
+        std::size_t m_queueLimit;
+        std::chrono::milliseconds m_queueTimeout;
+        PendingCalls& m_pending;
+    };
+}
@@ -0,0 +1,144 @@
+#include "stream.hh"
+
+namespace twobot {
+    namespace {
+        bool _is_space(char c) {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+    }
+
+    ResponseStream::ResponseStream(ElementCallback callback)
+        : m_callback(std::move(callback))
+    {
+
+    }
+
+    void ResponseStream::feed(std::string_view chunk) {
+        for (char c : chunk) {
+            if (m_state == State::ARRAY)
+                scanArray(c);
+            else
+                scanEnvelope(c);
+        }
+    }
+
+    void ResponseStream::scanEnvelope(char c) {
+        if (m_inString) {
+            m_envelope.push_back(c);
+            if (m_escape)
+                m_escape = false;
+            else if (c == '\\')
+                m_escape = true;
+            else if (c == '"') {
+                m_inString = false;
+                m_readingKey = false;
+                return;
+            }
+            if (m_readingKey)
+                m_key.push_back(c);
+            return;
+        }
+
+        if (m_state == State::DATA_VALUE) {
+            if (_is_space(c)) {
+                m_envelope.push_back(c);
+                return;
+            }
+            m_state = State::ENVELOPE;
+            if (c == '[') {
+                m_envelope.push_back(c);
+                m_state = State::ARRAY;
+                m_elementDepth = 0;
+                return;
+            }
+            // data不是数组时原样保留
+        }
+
+        m_envelope.push_back(c);
+        switch (c) {
+        case '"':
+            m_inString = true;
+            if (m_depth == 1 && m_expectKey) {
+                m_readingKey = true;
+                m_expectKey = false;
+                m_key.clear();
+            }
+            break;
+        case '{':
+        case '[':
+            ++m_depth;
+            if (m_depth == 1 && c == '{')
+                m_expectKey = true;
+            break;
+        case '}':
+        case ']':
+            --m_depth;
+            break;
+        case ',':
+            if (m_depth == 1)
+                m_expectKey = true;
+            break;
+        case ':':
+            if (m_depth == 1 && m_key == "data")
+                m_state = State::DATA_VALUE;
+            break;
+        default:
+            break;
+        }
+    }
+
+    void ResponseStream::scanArray(char c) {
+        if (m_inString) {
+            if (m_callback)
+                m_element.push_back(c);
+            if (m_escape)
+                m_escape = false;
+            else if (c == '\\')
+                m_escape = true;
+            else if (c == '"')
+                m_inString = false;
+            return;
+        }
+
+        if (m_elementDepth == 0) {
+            if (_is_space(c))
+                return;
+            if (c == ',' || c == ']') {
+                // 数字、布尔之类的标量元素到分隔符才结束
+                emit();
+                if (c == ']') {
+                    m_envelope.push_back(c);
+                    m_state = State::ENVELOPE;
+                }
+                return;
+            }
+        }
+
+        if (m_callback)
+            m_element.push_back(c);
+        switch (c) {
+        case '"':
+            m_inString = true;
+            break;
+        case '{':
+        case '[':
+            ++m_elementDepth;
+            break;
+        case '}':
+        case ']':
+            if (--m_elementDepth == 0)
+                emit();
+            break;
+        default:
+            break;
+        }
+    }
+
+    void ResponseStream::emit() {
+        if (m_element.empty())
+            return;
+        if (m_callback)
+            m_callback(m_element);
+        m_element.clear();
+    }
+}
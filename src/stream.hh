@@ -0,0 +1,44 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace twobot {
+    // 增量扫描OneBot响应 {"status":...,"retcode":...,"data":[...],"echo":...}
+    // data数组的元素逐个交给回调，其余字段留在envelope里(data变为空数组)，内存占用只和单个元素有关
+    class ResponseStream {
+    public:
+        using ElementCallback = std::function<void(std::string_view element)>;
+
+        // callback为空时只收集envelope，不缓存元素
+        explicit ResponseStream(ElementCallback callback = nullptr);
+
+        void feed(std::string_view chunk);
+
+        // 去掉data数组元素之后的响应，feed完所有数据后才完整
+        const std::string& envelope() const { return m_envelope; }
+
+    private:
+        enum class State {
+            ENVELOPE,   // 顶层对象
+            DATA_VALUE, // 读到了"data":，等待值
+            ARRAY       // data数组内部
+        };
+
+        void scanEnvelope(char c);
+        void scanArray(char c);
+        void emit();
+
+        ElementCallback m_callback;
+        std::string m_envelope;
+        std::string m_element;
+        std::string m_key;
+        State m_state = State::ENVELOPE;
+        int m_depth = 0;         // envelope的嵌套深度
+        int m_elementDepth = 0;  // 当前元素的嵌套深度
+        bool m_inString = false;
+        bool m_escape = false;
+        bool m_expectKey = false; // 顶层对象中下一个字符串是键
+        bool m_readingKey = false;
+    };
+}
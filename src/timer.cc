@@ -0,0 +1,353 @@
+#include "timer.hh"
+#include <filesystem>
+#include <iostream>
+
+namespace twobot {
+    TimerWheel::TimerWheel()
+        : m_epoch(std::chrono::steady_clock::now())
+    {
+        std::fill(std::begin(m_slots), std::end(m_slots), NIL);
+    }
+
+    TimerWheel::~TimerWheel() {
+        stop();
+    }
+
+    void TimerWheel::start(Executor executor) {
+        std::lock_guard lock(m_mtx);
+        if (m_running)
+            return;
+        m_executor = std::move(executor);
+        m_running = true;
+        m_thread = std::thread([this] { run(); });
+    }
+
+    void TimerWheel::stop() {
+        {
+            std::lock_guard lock(m_mtx);
+            if (!m_running)
+                return;
+            m_running = false;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+
+    TimerWheel::Id TimerWheel::add(std::chrono::milliseconds delay, std::chrono::milliseconds period, Job job) {
+        auto ticks = [](std::chrono::milliseconds duration) {
+            return duration.count() <= 0 ? uint64_t(0) : uint64_t((duration + TICK - std::chrono::milliseconds(1)) / TICK);
+        };
+        std::unique_lock lock(m_mtx);
+        // 没有定时器时计时线程不再逐tick推进，先追上当前时间
+        if (m_size == 0)
+            m_next = std::max(m_next, nowTick());
+        uint32_t index;
+        if (!m_free.empty()) {
+            index = m_free.back();
+            m_free.pop_back();
+        }
+        else {
+            index = static_cast<uint32_t>(m_nodes.size());
+            m_nodes.emplace_back();
+        }
+        auto& node = m_nodes[index];
+        // 到期时间向上取整到tick，保证不会提前执行
+        auto due = std::chrono::steady_clock::now() - m_epoch + std::max(delay, std::chrono::milliseconds(0));
+        node.expire = static_cast<uint64_t>((due + TICK - std::chrono::nanoseconds(1)) / TICK);
+        node.period = std::max<uint64_t>(ticks(period), period.count() > 0 ? 1 : 0);
+        node.job = std::move(job);
+        ++node.generation;
+        link(index);
+        bool wake = m_size++ == 0;
+        Id id = (uint64_t(node.generation) << 32) | index;
+        lock.unlock();
+        if (wake)
+            m_cv.notify_all();
+        return id;
+    }
+
+    bool TimerWheel::cancel(Id id) {
+        auto index = static_cast<uint32_t>(id & 0xffffffff);
+        auto generation = static_cast<uint32_t>(id >> 32);
+        std::lock_guard lock(m_mtx);
+        if (index >= m_nodes.size())
+            return false;
+        auto& node = m_nodes[index];
+        if (node.generation != generation || node.slot == NIL)
+            return false;
+        unlink(index);
+        release(index);
+        return true;
+    }
+
+    std::size_t TimerWheel::size() const {
+        std::lock_guard lock(m_mtx);
+        return m_size;
+    }
+
+    uint64_t TimerWheel::nowTick() const {
+        return static_cast<uint64_t>((std::chrono::steady_clock::now() - m_epoch) / TICK);
+    }
+
+    void TimerWheel::link(uint32_t index) {
+        auto& node = m_nodes[index];
+        uint64_t expire = node.expire;
+        // 已经过期的放到下一个要处理的格子
+        if (expire < m_next)
+            expire = m_next;
+        uint64_t delta = expire - m_next;
+        uint32_t slot;
+        if (delta < ROOT_SIZE) {
+            slot = expire & (ROOT_SIZE - 1);
+        }
+        else {
+            if (delta > MAX_DELAY)
+                expire = m_next + MAX_DELAY;
+            uint32_t level = 0;
+            while (level + 1 < LEVELS && delta >= (uint64_t(1) << (ROOT_BITS + (level + 1) * LEVEL_BITS)))
+                ++level;
+            slot = ROOT_SIZE + level * LEVEL_SIZE + ((expire >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1));
+        }
+        node.slot = slot;
+        node.prev = NIL;
+        node.next = m_slots[slot];
+        if (node.next != NIL)
+            m_nodes[node.next].prev = index;
+        m_slots[slot] = index;
+    }
+
+    void TimerWheel::unlink(uint32_t index) {
+        auto& node = m_nodes[index];
+        if (node.prev != NIL)
+            m_nodes[node.prev].next = node.next;
+        else
+            m_slots[node.slot] = node.next;
+        if (node.next != NIL)
+            m_nodes[node.next].prev = node.prev;
+        node.slot = NIL;
+    }
+
+    void TimerWheel::release(uint32_t index) {
+        m_nodes[index].job = nullptr;
+        m_free.push_back(index);
+        --m_size;
+    }
+
+    uint32_t TimerWheel::cascade(uint32_t level) {
+        uint32_t slot = (m_next >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+        auto& head = m_slots[ROOT_SIZE + level * LEVEL_SIZE + slot];
+        uint32_t index = head;
+        head = NIL;
+        while (index != NIL) {
+            uint32_t next = m_nodes[index].next;
+            link(index);
+            index = next;
+        }
+        return slot;
+    }
+
+    void TimerWheel::advance(std::vector<Job>& expired) {
+        uint32_t slot = m_next & (ROOT_SIZE - 1);
+        // 第一层转完一圈时，逐层把上层的下一格分配下来
+        if (slot == 0) {
+            for (uint32_t level = 0; level < LEVELS && cascade(level) == 0; ++level);
+        }
+        uint64_t tick = m_next++;
+        uint32_t index = m_slots[slot];
+        m_slots[slot] = NIL;
+        while (index != NIL) {
+            auto& node = m_nodes[index];
+            uint32_t next = node.next;
+            node.slot = NIL;
+            // 被截断到最后一层的远期定时器还没有真正到期
+            if (node.expire > tick) {
+                link(index);
+            }
+            else if (node.period != 0) {
+                expired.push_back(node.job);
+                node.expire += node.period;
+                link(index);
+            }
+            else {
+                expired.push_back(std::move(node.job));
+                release(index);
+            }
+            index = next;
+        }
+    }
+
+    void TimerWheel::run() {
+        std::unique_lock lock(m_mtx);
+        while (m_running) {
+            std::vector<Job> expired;
+            auto now = nowTick();
+            if (m_size == 0)
+                m_next = std::max(m_next, now + 1);
+            while (m_next <= now && m_size != 0)
+                advance(expired);
+            if (!expired.empty()) {
+                lock.unlock();
+                for (auto& job : expired)
+                    m_executor(std::move(job));
+                lock.lock();
+                continue;
+            }
+            if (m_size == 0)
+                m_cv.wait(lock, [this] { return !m_running || m_size != 0; });
+            else
+                m_cv.wait_until(lock, m_epoch + TICK * m_next, [this] { return !m_running; });
+        }
+    }
+
+    TimerStore::TimerStore(std::string path)
+        : m_path(std::move(path))
+    {
+        std::lock_guard lock(m_mtx);
+        replay();
+        // 启动时总是压缩一次，去掉作废的行和写了一半的最后一行
+        compact();
+    }
+
+    void TimerStore::replay() {
+        std::ifstream file(m_path);
+        if (!file)
+            return;
+        auto restore = [this](uint64_t key, const nlohmann::json& item) {
+            m_entries[key] = Record{ {
+                item.at("name").get<std::string>(),
+                item.at("due_ms").get<int64_t>(),
+                item.value("payload", nlohmann::json{})
+            }, 0, true };
+            m_nextKey = std::max(m_nextKey, key + 1);
+        };
+        // 旧版本把全部定时器写成一个json数组
+        if (file.peek() == '[') {
+            try {
+                for (auto& item : nlohmann::json::parse(file))
+                    restore(m_nextKey, item);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Timer Store Load Error: " << e.what() << std::endl;
+            }
+            return;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty())
+                continue;
+            try {
+                auto item = nlohmann::json::parse(line);
+                auto key = item.at("key").get<uint64_t>();
+                if (item.at("op") == "put")
+                    restore(key, item);
+                else
+                    m_entries.erase(key);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Timer Store Load Error: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    std::vector<std::pair<uint64_t, TimerStore::Entry>> TimerStore::restore() {
+        std::vector<std::pair<uint64_t, Entry>> entries;
+        std::lock_guard lock(m_mtx);
+        for (auto& [key, record] : m_entries) {
+            if (!record.restored)
+                continue;
+            record.restored = false;
+            entries.emplace_back(key, record.entry);
+        }
+        return entries;
+    }
+
+    uint64_t TimerStore::put(Entry entry) {
+        std::lock_guard lock(m_mtx);
+        auto key = m_nextKey++;
+        append({
+            {"op", "put"},
+            {"key", key},
+            {"name", entry.name},
+            {"due_ms", entry.due_ms},
+            {"payload", entry.payload}
+        });
+        m_entries.emplace(key, Record{ std::move(entry) });
+        return key;
+    }
+
+    void TimerStore::bind(uint64_t key, TimerWheel::Id id) {
+        std::lock_guard lock(m_mtx);
+        auto it = m_entries.find(key);
+        if (it == m_entries.end())
+            return;
+        it->second.id = id;
+        m_bound[id] = key;
+    }
+
+    void TimerStore::erase(uint64_t key) {
+        std::lock_guard lock(m_mtx);
+        auto it = m_entries.find(key);
+        if (it == m_entries.end())
+            return;
+        m_bound.erase(it->second.id);
+        m_entries.erase(it);
+        remove(key);
+    }
+
+    bool TimerStore::cancel(TimerWheel::Id id) {
+        std::lock_guard lock(m_mtx);
+        auto it = m_bound.find(id);
+        if (it == m_bound.end())
+            return false;
+        auto key = it->second;
+        m_entries.erase(key);
+        m_bound.erase(it);
+        remove(key);
+        return true;
+    }
+
+    void TimerStore::remove(uint64_t key) {
+        // 作废的行多于存活的记录时整体重写，否则只追加一行
+        if (m_lines + 1 > 2 * m_entries.size() + 64)
+            compact();
+        else
+            append({ {"op", "erase"}, {"key", key} });
+    }
+
+    void TimerStore::append(const nlohmann::json& line) {
+        if (!m_journal.is_open())
+            return;
+        m_journal << line.dump() << '\n';
+        m_journal.flush();
+        if (!m_journal)
+            std::cerr << "Timer Store Write Error: " << m_path << std::endl;
+        ++m_lines;
+    }
+
+    void TimerStore::compact() {
+        m_journal.close();
+        auto temp = m_path + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::trunc);
+            for (auto& [key, record] : m_entries) {
+                file << nlohmann::json{
+                    {"op", "put"},
+                    {"key", key},
+                    {"name", record.entry.name},
+                    {"due_ms", record.entry.due_ms},
+                    {"payload", record.entry.payload}
+                }.dump() << '\n';
+            }
+            if (!file)
+                std::cerr << "Timer Store Write Error: " << temp << std::endl;
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp, m_path, ec);
+        if (ec)
+            std::cerr << "Timer Store Write Error: " << ec.message() << std::endl;
+        m_lines = m_entries.size();
+        m_journal.open(m_path, std::ios::app);
+        if (!m_journal)
+            std::cerr << "Timer Store Write Error: cannot open " << m_path << std::endl;
+    }
+}
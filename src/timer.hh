@@ -0,0 +1,122 @@
+#pragma once
+#include "twobot.hh"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace twobot {
+    // 分层时间轮，tick为10ms，第一层256格，其余三层各64格，覆盖约7.7天，更远的定时器在最后一层循环等待
+    // 添加和取消都是O(1)，节点放在数组里复用，支撑百万级定时器；到期的任务投递到执行器
+    class TimerWheel {
+    public:
+        using Id = uint64_t;
+        static constexpr std::chrono::milliseconds TICK{ 10 };
+
+        TimerWheel();
+        ~TimerWheel();
+
+        // 开始计时，停止期间到期的定时器在这里补发
+        void start(Executor executor);
+        // 停止计时线程，尚未到期的定时器保留到下一次start
+        void stop();
+
+        // period为0表示一次性定时器；周期定时器按固定节拍执行，不随执行耗时漂移
+        Id add(std::chrono::milliseconds delay, std::chrono::milliseconds period, Job job);
+        // 返回定时器是否还在等待
+        bool cancel(Id id);
+        std::size_t size() const;
+
+    private:
+        static constexpr uint32_t NIL = UINT32_MAX;
+        static constexpr uint32_t ROOT_BITS = 8;
+        static constexpr uint32_t LEVEL_BITS = 6;
+        static constexpr uint32_t ROOT_SIZE = 1u << ROOT_BITS;
+        static constexpr uint32_t LEVEL_SIZE = 1u << LEVEL_BITS;
+        static constexpr uint32_t LEVELS = 3; // 第一层之外的层数
+        static constexpr uint32_t SLOT_COUNT = ROOT_SIZE + LEVELS * LEVEL_SIZE;
+        static constexpr uint64_t MAX_DELAY = (uint64_t(1) << (ROOT_BITS + LEVELS * LEVEL_BITS)) - 1;
+
+        struct Node {
+            uint64_t expire = 0; // 到期的tick
+            uint64_t period = 0; // 周期，单位tick
+            Job job;
+            uint32_t prev = NIL;
+            uint32_t next = NIL;
+            uint32_t slot = NIL; // NIL表示空闲
+            uint32_t generation = 0;
+        };
+
+        uint64_t nowTick() const;
+        void link(uint32_t index);
+        void unlink(uint32_t index);
+        void release(uint32_t index);
+        // 把上层的一格重新分配到下层，返回该层的格号
+        uint32_t cascade(uint32_t level);
+        // 处理m_next这一个tick
+        void advance(std::vector<Job>& expired);
+        void run();
+
+        mutable std::mutex m_mtx;
+        std::condition_variable m_cv;
+        std::thread m_thread;
+        bool m_running = false;
+        Executor m_executor;
+
+        const std::chrono::steady_clock::time_point m_epoch;
+        uint64_t m_next = 0; // 下一个要处理的tick
+        std::vector<Node> m_nodes;
+        std::vector<uint32_t> m_free;
+        std::size_t m_size = 0;
+        uint32_t m_slots[SLOT_COUNT];
+    };
+
+    // 持久化的一次性定时器，以json行的日志追加记录put和erase，打开时重放日志恢复，
+    // 作废的行超过存活的记录时先写临时文件再改名压缩；崩溃时最多丢掉写了一半的最后一行
+    class TimerStore {
+    public:
+        struct Entry {
+            std::string name;
+            int64_t due_ms; // system_clock的毫秒时间戳，重启后steady_clock不连续
+            nlohmann::json payload;
+        };
+
+        // 重放文件中的日志，恢复上次退出时尚未执行的定时器
+        explicit TimerStore(std::string path);
+
+        // 取出从文件中恢复、还没有加入时间轮的定时器，每条只返回一次；本进程put的定时器不在其中
+        std::vector<std::pair<uint64_t, Entry>> restore();
+        uint64_t put(Entry entry);
+        // 记录定时器在时间轮中的id，供cancel使用；定时器已经执行过时忽略
+        void bind(uint64_t key, TimerWheel::Id id);
+        void erase(uint64_t key);
+        // 按时间轮id删除，返回是否是持久化定时器
+        bool cancel(TimerWheel::Id id);
+
+    private:
+        void replay();
+        void append(const nlohmann::json& line);
+        void remove(uint64_t key);
+        // 只写入存活的记录，替换原文件
+        void compact();
+
+        std::mutex m_mtx;
+        std::string m_path;
+        std::ofstream m_journal;
+        std::size_t m_lines = 0; // 日志中的行数
+        uint64_t m_nextKey = 1;
+        struct Record {
+            Entry entry;
+            TimerWheel::Id id = 0;
+            bool restored = false; // 从文件中恢复、还没有交给restore()的调用方
+        };
+        std::map<uint64_t, Record> m_entries;
+        std::unordered_map<TimerWheel::Id, uint64_t> m_bound;
+    };
+}
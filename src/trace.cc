@@ -0,0 +1,126 @@
+#include "trace.hh"
+
+namespace twobot {
+    namespace {
+        thread_local EventTrace* t_current = nullptr;
+
+        // 相对于epoch的微秒数，Chrome trace的ts和dur都以微秒为单位
+        double _us(TraceClock::time_point epoch, TraceClock::time_point time) {
+            return std::chrono::duration<double, std::micro>(time - epoch).count();
+        }
+
+        void _slice(nlohmann::json& events, const EventTrace& trace, TraceClock::time_point epoch, std::string name,
+            TraceClock::time_point begin, TraceClock::time_point end, nlohmann::json args = nlohmann::json::object()) {
+            if (begin == TraceClock::time_point{} || end == TraceClock::time_point{})
+                return;
+            args["event"] = trace.event;
+            args["trace"] = trace.id;
+            events.push_back({
+                {"name", std::move(name)},
+                {"ph", "X"},
+                {"ts", _us(epoch, begin)},
+                {"dur", _us(begin, end)},
+                {"pid", trace.self_id},
+                {"tid", trace.id},
+                {"args", std::move(args)}
+            });
+        }
+    }
+
+    std::size_t EventTrace::beginCall(std::string name) {
+        std::lock_guard lock(m_mtx);
+        m_calls.push_back({ std::move(name), TraceClock::now() });
+        return m_calls.size() - 1;
+    }
+
+    void EventTrace::endCall(std::size_t index, bool ok) {
+        std::lock_guard lock(m_mtx);
+        m_calls[index].resolved = TraceClock::now();
+        m_calls[index].ok = ok;
+    }
+
+    std::vector<EventTrace::ApiCall> EventTrace::calls() const {
+        std::lock_guard lock(m_mtx);
+        return m_calls;
+    }
+
+    Tracer::Tracer(const TraceConfig& config)
+        : m_config(config)
+    {
+        if (m_config.capacity == 0)
+            m_config.capacity = 1;
+        if (m_config.sample_every == 0)
+            m_config.sample_every = 1;
+        m_ring.reserve(m_config.capacity);
+    }
+
+    std::shared_ptr<EventTrace> Tracer::begin(TraceClock::time_point received) {
+        auto count = m_count++;
+        if (count % m_config.sample_every != 0)
+            return nullptr;
+        auto trace = new EventTrace();
+        trace->id = count;
+        trace->received = received;
+        trace->decoded = TraceClock::now();
+        // 记录要在所有引用释放后才完整，所以在删除器里提交，Tracer先销毁时直接丢弃
+        return std::shared_ptr<EventTrace>(trace, [tracer = weak_from_this()](EventTrace* trace) {
+            if (auto self = tracer.lock(); self && trace->enqueued != TraceClock::time_point{})
+                self->commit(trace);
+            else
+                delete trace;
+        });
+    }
+
+    void Tracer::commit(EventTrace* trace) {
+        std::unique_ptr<EventTrace> owned(trace);
+        std::lock_guard lock(m_mtx);
+        if (m_ring.size() < m_config.capacity)
+            m_ring.push_back(std::move(owned));
+        else
+            m_ring[m_next] = std::move(owned);
+        m_next = (m_next + 1) % m_config.capacity;
+    }
+
+    std::string Tracer::dump() const {
+        auto events = nlohmann::json::array();
+        std::lock_guard lock(m_mtx);
+        for (const auto& trace : m_ring) {
+            _slice(events, *trace, m_epoch, "decode", trace->received, trace->decoded);
+            _slice(events, *trace, m_epoch, "dispatch", trace->decoded, trace->enqueued);
+            _slice(events, *trace, m_epoch, "queue", trace->enqueued, trace->started);
+            _slice(events, *trace, m_epoch, "handler", trace->started, trace->finished);
+            for (const auto& call : trace->calls())
+                _slice(events, *trace, m_epoch, call.name, call.sent, call.resolved, { {"ok", call.ok} });
+        }
+        return nlohmann::json{
+            {"traceEvents", std::move(events)},
+            {"displayTimeUnit", "ms"}
+        }.dump();
+    }
+
+    TraceScope::TraceScope(EventTrace* trace)
+        : m_prev(t_current)
+    {
+        t_current = trace;
+    }
+
+    TraceScope::~TraceScope() {
+        t_current = m_prev;
+    }
+
+    TraceSpan TraceSpan::begin(const std::string& api_name) {
+        TraceSpan span;
+        if (t_current == nullptr)
+            return span;
+        span.m_trace = t_current->shared_from_this();
+        span.m_index = span.m_trace->beginCall(api_name);
+        return span;
+    }
+
+    void TraceSpan::end(bool ok) {
+        if (!m_trace)
+            return;
+        m_trace->endCall(m_index, ok);
+        m_trace.reset();
+    }
+}
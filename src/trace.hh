@@ -0,0 +1,91 @@
+#pragma once
+#include "twobot.hh"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace twobot {
+    using TraceClock = std::chrono::steady_clock;
+
+    // 一个事件从收到帧到监听器结束的各个时间点，以及监听器期间发出的API调用
+    // 帧、解码、入队三个时间点在IO线程上写入，开始和结束在事件线程上写入，API调用可能来自任意线程
+    class EventTrace : public std::enable_shared_from_this<EventTrace> {
+    public:
+        struct ApiCall {
+            std::string name;
+            TraceClock::time_point sent;
+            TraceClock::time_point resolved{}; // 调用失败前没有响应或者实例已经停止时为空
+            bool ok = false;
+        };
+
+        uint64_t id = 0;
+        uint64_t self_id = 0;
+        std::string event;
+        TraceClock::time_point received{};
+        TraceClock::time_point decoded{};
+        TraceClock::time_point enqueued{}; // 为空表示事件没有被派发，不会进入记录
+        TraceClock::time_point started{};
+        TraceClock::time_point finished{};
+
+        std::size_t beginCall(std::string name);
+        void endCall(std::size_t index, bool ok);
+        std::vector<ApiCall> calls() const;
+
+    private:
+        mutable std::mutex m_mtx;
+        std::vector<ApiCall> m_calls;
+    };
+
+    // 按Config::trace抽样事件，最后一个引用释放时(监听器结束且它发出的调用都已响应)写入环形缓冲区
+    class Tracer : public std::enable_shared_from_this<Tracer> {
+    public:
+        explicit Tracer(const TraceConfig& config);
+
+        // 没有抽中时返回nullptr，received为收到帧的时间
+        std::shared_ptr<EventTrace> begin(TraceClock::time_point received);
+
+        // 以Chrome trace event格式导出缓冲区中的记录，可以直接在chrome://tracing或Perfetto中打开
+        std::string dump() const;
+
+    private:
+        void commit(EventTrace* trace);
+
+        TraceConfig m_config;
+        TraceClock::time_point m_epoch = TraceClock::now();
+        std::atomic<uint64_t> m_count{ 0 };
+        mutable std::mutex m_mtx;
+        std::vector<std::unique_ptr<EventTrace>> m_ring;
+        std::size_t m_next = 0;
+    };
+
+    // 作用域内当前线程发出的API调用记在trace上，监听器执行期间有效
+    class TraceScope {
+    public:
+        explicit TraceScope(EventTrace* trace);
+        ~TraceScope();
+
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+    private:
+        EventTrace* m_prev;
+    };
+
+    // 一次API调用的记录，当前线程不在被抽样的监听器中时为空，开销只有一次thread_local读取
+    class TraceSpan {
+    public:
+        TraceSpan() = default;
+        static TraceSpan begin(const std::string& api_name);
+
+        explicit operator bool() const { return m_trace != nullptr; }
+        void end(bool ok);
+
+    private:
+        std::shared_ptr<EventTrace> m_trace;
+        std::size_t m_index = 0;
+    };
+}
@@ -0,0 +1,182 @@
+#include "transport.hh"
+#include <algorithm>
+
+namespace twobot {
+    void PendingCalls::add(std::size_t seq, std::shared_ptr<ApiSet::ApiResult::State> state, ApiSet::ElementCallback stream, TraceSpan span) {
+        std::lock_guard lock(m_mtx);
+        if (stream)
+            ++m_streams;
+        m_calls.emplace(seq, PendingCall{ std::move(state), std::chrono::steady_clock::now(), std::move(stream), std::move(span) });
+    }
+
+    std::optional<PendingCall> PendingCalls::take(std::size_t seq) {
+        std::lock_guard lock(m_mtx);
+        auto it = m_calls.find(seq);
+        if (it == m_calls.end())
+            return std::nullopt;
+        auto call = std::move(it->second);
+        m_calls.erase(it);
+        if (call.stream)
+            --m_streams;
+        if (m_calls.empty())
+            m_cv.notify_all();
+        return call;
+    }
+
+    void PendingCalls::bind(std::size_t seq, const void* session) {
+        std::lock_guard lock(m_mtx);
+        auto it = m_calls.find(seq);
+        if (it != m_calls.end())
+            it->second.session = session;
+    }
+
+    void PendingCalls::fail(std::size_t seq, const std::string& reason) {
+        if (auto call = take(seq)) {
+            call->span.end(false);
+            call->state->set({ false, { {"error", reason} } });
+        }
+    }
+
+    void PendingCalls::failSession(const void* session, const std::string& reason) {
+        std::vector<PendingCall> calls;
+        {
+            std::lock_guard lock(m_mtx);
+            for (auto it = m_calls.begin(); it != m_calls.end();) {
+                if (it->second.session != session) {
+                    ++it;
+                    continue;
+                }
+                if (it->second.stream)
+                    --m_streams;
+                calls.push_back(std::move(it->second));
+                it = m_calls.erase(it);
+            }
+            if (m_calls.empty())
+                m_cv.notify_all();
+        }
+        for (auto& call : calls) {
+            call.span.end(false);
+            call.state->set({ false, { {"error", reason} } });
+        }
+    }
+
+    bool PendingCalls::waitEmpty(std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock lock(m_mtx);
+        return m_cv.wait_until(lock, deadline, [this] { return m_calls.empty(); });
+    }
+
+    void PendingCalls::failAll(const std::string& reason) {
+        std::unordered_map<std::size_t, PendingCall> calls;
+        {
+            std::lock_guard lock(m_mtx);
+            calls.swap(m_calls);
+            m_streams = 0;
+            m_cv.notify_all();
+        }
+        for (auto& [seq, call] : calls) {
+            call.span.end(false);
+            call.state->set({ false, { {"error", reason} } });
+        }
+    }
+
+    HttpPool::HttpPool(std::string host, uint16_t port, std::size_t max_idle)
+        : m_host(std::move(host))
+        , m_port(port)
+        , m_maxIdle(max_idle)
+    {
+
+    }
+
+    std::unique_ptr<httplib::Client> HttpPool::acquire() {
+        {
+            std::lock_guard lock(m_mtx);
+            if (!m_idle.empty()) {
+                auto client = std::move(m_idle.back());
+                m_idle.pop_back();
+                return client;
+            }
+        }
+        auto client = std::make_unique<httplib::Client>(m_host, m_port);
+        client->set_keep_alive(true);
+        return client;
+    }
+
+    void HttpPool::release(std::unique_ptr<httplib::Client> client) {
+        std::lock_guard lock(m_mtx);
+        if (m_idle.size() < m_maxIdle)
+            m_idle.push_back(std::move(client));
+    }
+
+    RateLimiter::RateLimiter(double rate) {
+        if (rate > 0)
+            m_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    }
+
+    std::chrono::steady_clock::time_point RateLimiter::reserve() {
+        auto now = std::chrono::steady_clock::now();
+        if (m_interval == std::chrono::steady_clock::duration::zero())
+            return now;
+        std::lock_guard lock(m_mtx);
+        auto at = std::max(now, m_next);
+        m_next = at + m_interval;
+        return at;
+    }
+
+    bool succeeded(const nlohmann::json& response) {
+        if (!response.is_object())
+            return false;
+        if (auto retcode = response.find("retcode"); retcode != response.end() && retcode->is_number_integer())
+            return *retcode == 0 || *retcode == 1;
+        auto status = response.value("status", "");
+        return status == "ok" || status == "async";
+    }
+
+    void TransportMetrics::record(Transport transport, double latency_ms, bool ok) {
+        std::lock_guard lock(m_mtx);
+        auto index = static_cast<int>(transport);
+        auto& stats = m_stats[index];
+        if (ok) {
+            if (stats.calls == stats.errors)
+                stats.latency_ms = latency_ms;
+            else
+                stats.latency_ms += ALPHA * (latency_ms - stats.latency_ms);
+        }
+        stats.error_rate += ALPHA * ((ok ? 0.0 : 1.0) - stats.error_rate);
+        ++stats.calls;
+        if (!ok)
+            ++stats.errors;
+        m_lastSample[index] = Clock::now();
+    }
+
+    TransportStats TransportMetrics::get(Transport transport) const {
+        std::lock_guard lock(m_mtx);
+        return m_stats[static_cast<int>(transport)];
+    }
+
+    Transport TransportMetrics::choose() {
+        std::lock_guard lock(m_mtx);
+        const auto& ws = m_stats[static_cast<int>(Transport::WEBSOCKET)];
+        const auto& http = m_stats[static_cast<int>(Transport::HTTP)];
+        // 没有成功过的通道借用另一个通道的延迟，只按错误率比较
+        auto latency = [](const TransportStats& stats, const TransportStats& other) {
+            if (stats.calls > stats.errors)
+                return stats.latency_ms;
+            return other.calls > other.errors ? other.latency_ms : 0.0;
+        };
+        auto cost = [](double latency_ms, const TransportStats& stats) {
+            return (latency_ms + 1.0) / std::max(0.05, 1.0 - stats.error_rate);
+        };
+        auto best = Transport::WEBSOCKET;
+        if (ws.calls > 0 && http.calls > 0 && cost(latency(http, ws), http) < cost(latency(ws, http), ws))
+            best = Transport::HTTP;
+
+        auto other = best == Transport::WEBSOCKET ? Transport::HTTP : Transport::WEBSOCKET;
+        auto now = Clock::now();
+        auto& last = m_lastSample[static_cast<int>(other)];
+        if (now - last >= PROBE_INTERVAL) {
+            last = now;
+            return other;
+        }
+        return best;
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "twobot.hh"
+#include "trace.hh"
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <httplib.h>
+
+namespace twobot {
+    // 等待echo.seq响应的异步调用
+    struct PendingCall {
+        std::shared_ptr<ApiSet::ApiResult::State> state;
+        std::chrono::steady_clock::time_point sent;
+        ApiSet::ElementCallback stream = nullptr; // 流式调用的元素回调
+        TraceSpan span{}; // 在被抽样的监听器中发出时有效，响应时结束
+        const void* session = nullptr; // 帧实际发出的会话，在重连队列中时为空
+    };
+
+    // 实例内所有等待响应的异步调用，stop()时等待它们完成，超时后统一以失败结束
+    class PendingCalls {
+    public:
+        void add(std::size_t seq, std::shared_ptr<ApiSet::ApiResult::State> state, ApiSet::ElementCallback stream = nullptr, TraceSpan span = {});
+        std::optional<PendingCall> take(std::size_t seq);
+        // 记录调用的帧已经从session发出
+        void bind(std::size_t seq, const void* session);
+        // 以失败结束一个调用
+        void fail(std::size_t seq, const std::string& reason);
+        // 会话断开时以失败结束从它发出的调用，重连后不会再有响应
+        void failSession(const void* session, const std::string& reason);
+        // 有未完成的流式调用时，响应要先扫描envelope确定echo，才能决定是否构造DOM
+        bool hasStreams() const { return m_streams.load(std::memory_order_relaxed) > 0; }
+        // 等到没有未完成的调用或者到达deadline，返回是否已经清空
+        bool waitEmpty(std::chrono::steady_clock::time_point deadline);
+        void failAll(const std::string& reason);
+
+    private:
+        std::mutex m_mtx;
+        std::condition_variable m_cv;
+        std::unordered_map<std::size_t, PendingCall> m_calls;
+        std::atomic<std::size_t> m_streams{ 0 };
+    };
+
+    // 复用keep-alive连接的httplib客户端池，httplib::Client本身不是线程安全的，每次调用独占一个
+    class HttpPool {
+    public:
+        HttpPool(std::string host, uint16_t port, std::size_t max_idle = 16);
+
+        std::unique_ptr<httplib::Client> acquire();
+        // 请求失败的连接不应该归还
+        void release(std::unique_ptr<httplib::Client> client);
+
+    private:
+        std::string m_host;
+        uint16_t m_port;
+        std::size_t m_maxIdle;
+        std::mutex m_mtx;
+        std::vector<std::unique_ptr<httplib::Client>> m_idle;
+    };
+
+    // 出站调用的节流，按固定间隔依次发放发送时间，rate为0时不限制
+    class RateLimiter {
+    public:
+        explicit RateLimiter(double rate);
+
+        // 预定一次发送，返回可以发送的时间点
+        std::chrono::steady_clock::time_point reserve();
+
+    private:
+        std::mutex m_mtx;
+        std::chrono::steady_clock::duration m_interval{};
+        std::chrono::steady_clock::time_point m_next{};
+    };
+
+    // 响应是否成功：按envelope的retcode判断，没有retcode时看status，async也算成功
+    bool succeeded(const nlohmann::json& response);
+
+    // 按传输通道统计调用次数、错误和延迟，AutoMode据此选择通道
+    class TransportMetrics {
+    public:
+        // 失败的调用只计入错误率，不影响延迟的平均值
+        void record(Transport transport, double latency_ms, bool ok);
+        TransportStats get(Transport transport) const;
+        // WS已连接时在两者之间选择：还没有样本的通道视为未知，优先WS；都有样本时按错误率惩罚后的延迟取较小者
+        // 落选的通道超过PROBE_INTERVAL没有样本时让一次调用走它，重新测量
+        Transport choose();
+
+    private:
+        using Clock = std::chrono::steady_clock;
+        static constexpr double ALPHA = 0.2; // 滑动平均的权重
+        static constexpr std::chrono::seconds PROBE_INTERVAL{ 10 };
+
+        mutable std::mutex m_mtx;
+        TransportStats m_stats[2]{};
+        Clock::time_point m_lastSample[2]{ Clock::now(), Clock::now() }; // 最近一次记录或探测的时间
+    };
+}
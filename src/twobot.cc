@@ -5,6 +5,10 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #endif
@@ -12,160 +16,790 @@
 #include <httplib.h>
 #include <brynet/base/Packet.hpp>
 #include <brynet/net/http/WebSocketFormat.hpp>
+#include <brynet/net/http/HttpFormat.hpp>
 #include <brynet/net/wrapper/HttpServiceBuilder.hpp>
 #include <brynet/net/wrapper/ServiceBuilder.hpp>
 #include <brynet/base/AppStatus.hpp>
 #include <tbb/tbb.h>
 #include <BS_thread_pool.hpp>
 #include "jsonex.hh"
+#include "context.hh"
+#include "forward.hh"
+#include "runtime.hh"
+#include "arena.hh"
+#include "stream.hh"
 
 namespace twobot {
-	using PromMapType = tbb::concurrent_hash_map<std::size_t, std::promise<ApiSet::SyncResult>>;
-	extern PromMapType g_promMap = {};
-	using SessionMapType = tbb::concurrent_unordered_map<uint64_t, brynet::net::http::HttpSession::Ptr>;
-	extern SessionMapType g_sessionMap = {};
-
-	std::unique_ptr<BotInstance> BotInstance::createInstance(const Config& config) {
-		return std::unique_ptr<BotInstance>(new BotInstance{config} );
+	std::unique_ptr<BotInstance> BotInstance::createInstance(const Config& config, std::shared_ptr<Runtime> runtime) {
+		return std::unique_ptr<BotInstance>(new BotInstance{config, std::move(runtime)} );
 	}
 
 	ApiSet BotInstance::getApiSet(const uint64_t& id, const ApiSet::AsyncMode& mode) {
-		return { ApiSet::AsyncConfig{id}, mode };
+		return { ApiSet::AsyncConfig{id}, mode, context };
 	}
 
 	ApiSet BotInstance::getApiSet(const ApiSet::SyncMode& mode)
 	{
-		return { ApiSet::SyncConfig{config.host,config.api_port,config.token}, mode };
+		return { ApiSet::SyncConfig{config.host,config.api_port,config.token}, mode, context };
+	}
+
+	ApiSet BotInstance::getApiSet(const uint64_t& id, const ApiSet::AutoMode& mode)
+	{
+		return { ApiSet::AutoConfig{id, {config.host,config.api_port,config.token}}, mode, context };
 	}
 
-	BotInstance::BotInstance(const Config& config) 
+	BotInstance::BotInstance(const Config& config, std::shared_ptr<Runtime> runtime) 
 		: config(config)
+		, context(std::make_shared<BotContext>(config, std::move(runtime)))
 	{
 
 	}
 
+	BotInstance::~BotInstance() {
+		stop();
+		// 等待正在访问实例的IO回调和事件任务结束，之后它们都会直接返回
+		std::unique_lock lock(context->lifetime);
+		context->alive = false;
+		// 在调用者的线程上释放运行时，私有的运行时在这里停止，不会在它自己的工作线程上析构
+		context->runtime.reset();
+	}
+
+	ConnState BotInstance::getConnState(uint64_t id) const {
+		return context->sessions.state(id);
+	}
+
+	TenantStats BotInstance::getTenantStats(uint64_t self_id) const {
+		TenantStats total;
+		for (auto& fair : context->fair)
+		{
+			if (!fair)
+				continue;
+			auto stats = fair->stats(self_id);
+			// 平均耗时按处理数加权合并
+			auto handled = total.handled + stats.handled;
+			if (handled != 0)
+				total.handler_ms_avg = (total.handler_ms_avg * total.handled + stats.handler_ms_avg * stats.handled) / handled;
+			total.queued += stats.queued;
+			total.running += stats.running;
+			total.handled = handled;
+			total.handler_ms_total += stats.handler_ms_total;
+		}
+		return total;
+	}
+
+	TransportStats BotInstance::getTransportStats(Transport transport) const {
+		return context->metrics.get(transport);
+	}
+
+	void BotInstance::setHandlerBudget(const EventType& type, std::chrono::milliseconds budget) {
+		if (context->watchdog)
+			context->watchdog->setBudget(type, budget);
+	}
+
+	HandlerStats BotInstance::getHandlerStats(const EventType& type) const {
+		if (!context->watchdog)
+			return {};
+		return context->watchdog->stats(type);
+	}
+
+	bool BotInstance::findMessage(uint64_t self_id, int64_t message_id, const std::function<void(const StoredMessage&)>& visitor) const {
+		if (!context->messages)
+			return false;
+		return context->messages->find(self_id, message_id, visitor);
+	}
+
+	std::size_t BotInstance::groupHistory(uint64_t group_id, int64_t from, int64_t to, const std::function<bool(const StoredMessage&)>& visitor) const {
+		if (!context->messages)
+			return 0;
+		return context->messages->groupRange(group_id, from, to, visitor);
+	}
+
+	std::vector<SearchHit> BotInstance::searchMessages(const SearchQuery& query) const {
+		if (!context->search)
+			return {};
+		return context->search->search(query);
+	}
+
+	std::string BotInstance::dumpTrace() const {
+		if (!context->tracer)
+			return R"({"traceEvents":[]})";
+		return context->tracer->dump();
+	}
+
 	template<Event::Concept E>
-	void BotInstance::onEvent(std::function<void(const E&)> callback) {
-		this->event_callbacks[E::getType()] = Callback([callback](const Event::Variant& event) {
+	void BotInstance::onEvent(std::function<void(const E&)> callback, Event::Filter filter) {
+		addHandler(E::getType(), [callback](const Event::Variant& event) -> nlohmann::json {
+			callback(*std::get_if<E>(&event));
+			return nullptr;
+		}, std::move(filter));
+	}
+
+	void BotInstance::addHandler(const EventType& type, Callback callback, Event::Filter filter) {
+		filter.normalize();
+		this->event_callbacks[type] = Handler{ Callback([type, callback](const Event::Variant& event) -> nlohmann::json {
 			try {
-				callback(*std::get_if<E>(&event));
+				return callback(event);
 			}
 			catch (const std::exception& e) {
-				const auto& eventType = E::getType();
-				std::cerr << "EventType: {" << eventType.post_type << ", " << eventType.sub_type << "}\n";
+				std::cerr << "EventType: {" << type.post_type << ", " << type.sub_type << "}\n";
 				std::cerr << "\tBotInstance::onEvent error: " << e.what() << std::endl;
 			}
-		});
+			return nullptr;
+		}), std::move(filter) };
 	}
 
-	void BotInstance::start() {
-		using namespace brynet::base;
-		using namespace brynet::net;
-		using namespace brynet::net::http;
-		auto websocket_port = config.ws_port;
-		BS::thread_pool pool;
-		auto service = IOThreadTcpService::Create();
-		service->startWorkerThread(1);
+	namespace {
+		// 按OneBot的上报格式得到事件类型
+		std::pair<std::string, std::string> _classify(const EventJson& payload)
+		{
+			std::string post_type = payload.value("post_type", "");
+			std::string sub_type;
+			if (post_type == "message")
+				sub_type = payload.value("message_type", "");
+			else if (post_type == "meta_event")
+				sub_type = payload.value("sub_type", "");
+			else if (post_type == "notice")
+				sub_type = payload.value("notice_type", "");
+			return { std::move(post_type), std::move(sub_type) };
+		}
+	}
 
-		auto ws_enter_callback = [this, &pool](const HttpSession::Ptr& httpSession,
-			WebSocketFormat::WebSocketFrameType opcode,
-			const std::string& payload) {
-				try {
-					nlohmann::json json_payload = nlohmann::json::parse(payload);
-					std::string post_type;
-					std::string sub_type;
-
-					// 忽略心跳包
-					if(json_payload.contains("meta_event_type"))
-						if(json_payload["meta_event_type"] == "heartbeat")
-							return;
-
-					if (!json_payload.contains("post_type"))
-					{
-						if (json_payload["echo"]["seq"].is_number_integer()) 
-						{
-							auto seq = json_payload["echo"]["seq"].get<std::size_t>();
-							const auto& data = json_payload["data"];
-							PromMapType::accessor acc;
-							g_promMap.find(acc, seq);
-							acc->second.set_value({ !data.is_null(), data });
-							g_promMap.erase(acc);
-						}
+	namespace {
+		// 消息写入存储、撤回缓存和全文索引，撤回通知在派发前带上原消息；即使没有消息监听器也要记录
+		void _remember(BotContext& context, std::string_view post_type, EventJson& payload, std::string_view raw) {
+			if (post_type == "message")
+			{
+				// 存储中已有的消息是重连重放或者多条连接上报的同一条，不再重复记录和索引；
+				// 因为过大或者磁盘写满而没有存下的照常记录，没有存储时由索引自己按message_id去重
+				if (context.messages && !context.messages->append(payload, raw))
+				{
+					auto message_id = payload.find("message_id");
+					if (message_id != payload.end() && message_id->is_number_integer()
+						&& context.messages->find(payload.value("self_id", uint64_t(0)), message_id->get<int64_t>(), [](const StoredMessage&) {}))
 						return;
+				}
+				if (context.recalls)
+					context.recalls->record(payload);
+				if (context.search)
+					context.search->add(payload);
+			}
+			else if (post_type == "notice" && context.recalls)
+			{
+				context.recalls->attach(payload);
+			}
+		}
+
+		// 解析响应并完成等待的调用
+		void _handle_response(BotContext& context, const std::string& payload) {
+			std::optional<PendingCall> call;
+			// 有流式调用在等待时先只扫描出envelope确定echo，流式调用的元素再逐个解析，不构造整个DOM
+			if (context.pending.hasStreams())
+			{
+				ResponseStream scan;
+				scan.feed(payload);
+				auto envelope = nlohmann::json::parse(scan.envelope(), nullptr, false);
+				if (!envelope.is_object() || !envelope["echo"]["seq"].is_number_integer())
+					return;
+				call = context.pending.take(envelope["echo"]["seq"].get<std::size_t>());
+				if (!call.has_value())
+					return;
+				if (call->stream)
+				{
+					std::string error;
+					try {
+						ResponseStream stream(call->stream);
+						stream.feed(payload);
 					}
+					catch (const std::exception& e) {
+						error = e.what();
+					}
+					bool ok = error.empty() && succeeded(envelope);
+					call->span.end(ok);
+					std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - call->sent;
+					context.metrics.record(Transport::WEBSOCKET, latency.count(), ok);
+					if (!error.empty())
+						envelope = { {"error", error} };
+					call->state->set({ ok, std::move(envelope) });
+					return;
+				}
+			}
 
-					post_type = (std::string)json_payload["post_type"];
+			auto json_payload = nlohmann::json::parse(payload);
+			if (!call.has_value())
+			{
+				if (!json_payload["echo"]["seq"].is_number_integer())
+					return;
+				call = context.pending.take(json_payload["echo"]["seq"].get<std::size_t>());
+				if (!call.has_value())
+					return;
+			}
+			bool ok = succeeded(json_payload);
+			auto& data = json_payload["data"];
+			call->span.end(ok);
+			std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - call->sent;
+			context.metrics.record(Transport::WEBSOCKET, latency.count(), ok);
+			// 续体会被投递到事件线程池，等待中的协程在那里恢复
+			// 成功与否看envelope，踢人、撤回等调用成功时data为null
+			call->state->set({ ok, std::move(data) });
+		}
+	}
+
+	void BotInstance::handleResponse(const std::string& payload) {
+		// 有流式调用在等待时响应可能是几MB的列表，echo在data之后，找到它就要扫描整个响应；
+		// 扫描、查找调用和逐个元素的回调都放到LIFECYCLE通道，IO线程只复制一次响应
+		if (context->pending.hasStreams() && context->executor)
+		{
+			context->executor([context = context, payload = payload] {
+				try {
+					_handle_response(*context, payload);
+				}
+				catch (const std::exception& e) {
+					std::cerr << "Response Handler Exception: " << e.what() << std::endl;
+				}
+			});
+			return;
+		}
+		_handle_response(*context, payload);
+	}
+
+	void BotInstance::handlePayload(const std::string& payload, const std::shared_ptr<brynet::net::http::HttpSession>& httpSession, bool is_client) {
+		auto received = context->tracer ? TraceClock::now() : TraceClock::time_point{};
+		try {
+			// 不含"post_type"的一定是API响应，直接解析为nlohmann::json交给等待的调用，省掉一次转换
+			if (payload.find("\"post_type\"") == std::string::npos)
+			{
+				handleResponse(payload);
+				return;
+			}
 
-					if (post_type == "message")
-						sub_type = (std::string)json_payload["message_type"];
-					else if (post_type == "meta_event")
-						sub_type = (std::string)json_payload["sub_type"];
-					else if (post_type == "notice")
-						sub_type = (std::string)json_payload["notice_type"];
-					
+			auto arena = config.event_arena ? EventArena::acquire() : nullptr;
+			EventJson json_payload;
+			{
+				ArenaScope scope(arena.get());
+				json_payload = EventJson::parse(payload);
+			}
 
-					EventType event_type = {
-						post_type,
-						sub_type
-					};
+			// 忽略心跳包
+			if (json_payload.value("meta_event_type", "") == "heartbeat")
+				return;
+			// 顶层没有post_type的是data里恰好带有"post_type"的API响应，例如get_msg
+			if (!json_payload.contains("post_type"))
+			{
+				if (json_payload.contains("echo"))
+					handleResponse(payload);
+				return;
+			}
+			countDecodedEvent();
+			auto trace = context->tracer ? context->tracer->begin(received) : nullptr;
 
-					auto event = Event::construct(event_type);
-					if (!event.has_value())
-						return;
+			auto [post_type, sub_type] = _classify(json_payload);
+			EventType event_type = {
+				post_type,
+				sub_type
+			};
+			_remember(*context, post_type, json_payload, payload);
+			auto self_id = json_payload["self_id"].get<uint64_t>();
 
-					std::visit([&payload, httpSession](auto&& e) { 
-						e.raw_msg = nlohmann::json::parse(payload); 
-						e.raw_msg.get_to(e);
-						if constexpr (std::is_convertible_v<decltype(e), Event::ConnectEvent>)
-						{
-							g_sessionMap[e.self_id] = httpSession;
-						}
-					}, *event);
-
-					if (event_callbacks.count(event_type) != 0) {
-						pool.detach_task([this, l_event = std::move(event)] {
-							std::visit([this](auto&& e) {
-								event_callbacks[e.getType()](e);
-							}, *l_event);
-						});
-					}
+			// 连接事件无论是否注册监听器都要记录会话
+			if (event_type == Event::ConnectEvent::getType())
+			{
+				context->sessions.connect(self_id, httpSession, is_client,
+					is_client && context->forward ? context->forward->deflate() : nullptr);
+			}
+
+			// WS上没有响应可写，快速操作转为.handle_quick_operation调用
+			// 事件没有被派发时json_payload仍在arena中，这里保留一份引用，arena在json_payload析构之后才回收
+			dispatchEvent(event_type, json_payload, [this, self_id](const EventJson& context, const nlohmann::json& operation) {
+				if (operation.is_null())
+					return;
+				getApiSet(self_id).callApi("/.handle_quick_operation", {
+					{"context", context},
+					{"operation", operation}
+				});
+			}, arena, std::move(trace));
+		}
+		catch (const std::exception& e) {
+			std::cerr << "Payload Handler Exception: " << e.what() << std::endl;
+		}
+	}
+
+	void BotInstance::handlePost(const std::string& body, const QuickReply& reply) {
+		auto received = context->tracer ? TraceClock::now() : TraceClock::time_point{};
+		try {
+			auto arena = config.event_arena ? EventArena::acquire() : nullptr;
+			EventJson json_payload;
+			{
+				ArenaScope scope(arena.get());
+				json_payload = EventJson::parse(body);
+			}
+			if (!json_payload.contains("post_type")
+				|| json_payload.value("meta_event_type", "") == "heartbeat")
+			{
+				reply(json_payload, nullptr);
+				return;
+			}
+			countDecodedEvent();
+			auto trace = context->tracer ? context->tracer->begin(received) : nullptr;
+			auto [post_type, sub_type] = _classify(json_payload);
+			_remember(*context, post_type, json_payload, body);
+			if (!dispatchEvent({ post_type, sub_type }, json_payload, reply, arena, std::move(trace)))
+				reply(json_payload, nullptr);
+		}
+		catch (const std::exception& e) {
+			std::cerr << "HTTP Post Handler Exception: " << e.what() << std::endl;
+			reply(nullptr, nullptr);
+		}
+	}
+
+	namespace {
+		// 元事件(含连接事件)走LIFECYCLE，消息走INTERACTIVE，通知和请求走NOTICE
+		Lane _lane_of(const EventType& type) {
+			if (type.post_type == "meta_event")
+				return Lane::LIFECYCLE;
+			if (type.post_type == "message")
+				return Lane::INTERACTIVE;
+			return Lane::NOTICE;
+		}
+
+		// 事件和解码它的arena一起投递，成员按声明的逆序析构，保证事件先于arena释放
+		struct ArenaEvent {
+			std::shared_ptr<EventArena> arena;
+			std::optional<Event::Variant> event;
+		};
+	}
+
+	bool BotInstance::dispatchEvent(const EventType& event_type, EventJson& json_payload, QuickReply reply, std::shared_ptr<EventArena> arena, std::shared_ptr<EventTrace> trace) {
+		if (!context->accepting)
+			return false;
+
+		// 在解码之前完成监听器查找和过滤，被丢弃的事件不会构造事件结构体，也不会进入线程池
+		auto handler = event_callbacks.find(event_type);
+		bool local = handler != event_callbacks.end() && handler->second.filter.match(json_payload);
+		bool remote = context->bus && context->bus->subscribed(event_type);
+		if (!local && !remote)
+			return false;
+
+		// 过滤结果只取决于事件内容，重复的事件到这里的结果相同，只对要派发的事件去重；连接等元事件每条连接各有一份，不去重
+		if (context->dedup && event_type.post_type != "meta_event" && context->dedup->duplicate(json_payload))
+			return false;
+
+		// 总线上的消费者不经过本进程的过滤器，也不能快速回复
+		if (remote)
+			context->bus->publish(event_type, json_payload.value("self_id", uint64_t(0)), json_payload.value("time", int64_t(0)), EventJson::to_msgpack(json_payload));
+		if (!local)
+			return false;
+
+		auto event = Event::construct(event_type);
+		if (!event.has_value())
+			return false;
+
+		auto self_id = json_payload.value("self_id", uint64_t(0));
+		Watchdog::Keys keys{ self_id };
+		if (context->watchdog)
+		{
+			keys.user_id = json_payload.value("user_id", uint64_t(0));
+			keys.group_id = json_payload.value("group_id", uint64_t(0));
+			keys.message_id = json_payload.value("message_id", int64_t(0));
+		}
+		std::visit([&json_payload](auto&& e) { 
+			e.raw_msg = std::move(json_payload);
+			e.raw_msg.get_to(e);
+		}, *event);
+
+		if (trace)
+		{
+			trace->self_id = self_id;
+			trace->event = std::string(event_type.post_type) + "." + std::string(event_type.sub_type);
+			trace->enqueued = TraceClock::now();
+		}
+
+		Job job = [context = context, &type = handler->first, &callback = handler->second.callback, l_event = ArenaEvent{ std::move(arena), std::move(event) }, reply = std::move(reply), trace = std::move(trace), keys] {
+			std::shared_lock lock(context->lifetime);
+			if (!context->alive)
+				return;
+			if (trace)
+				trace->started = TraceClock::now();
+			nlohmann::json operation;
+			{
+				TraceScope scope(trace.get());
+				{
+					WatchdogScope watch(context->watchdog.get(), type, keys);
+					operation = callback(*l_event.event);
 				}
-				catch (const std::exception& e) {
-					std::cerr << "WebSocket CallBack Exception: " << e.what() << std::endl;
+				std::visit([&](auto&& e) {
+					reply(e.raw_msg, operation);
+				}, *l_event.event);
+			}
+			if (trace)
+				trace->finished = TraceClock::now();
+		};
+		auto lane = _lane_of(event_type);
+		// 被隔离的监听器不再占用原来的通道，也不参与公平调度
+		if (context->watchdog && context->watchdog->quarantined(event_type))
+			context->laneExecutor(Lane::BACKGROUND)(std::move(job));
+		else if (auto& fair = context->fair[static_cast<std::size_t>(lane)])
+			fair->submit(self_id, std::move(job));
+		else
+			context->laneExecutor(lane)(std::move(job));
+		return true;
+	}
+
+	namespace {
+		// 同一条keep-alive连接上的上报可能被流水线发送，而监听器在线程池中并发执行，
+		// 每个请求先占一个序号，完成后按序号顺序写回响应
+		class PostResponder {
+		public:
+			uint64_t reserve() {
+				std::lock_guard lock(m_mtx);
+				return m_next++;
+			}
+
+			void complete(const brynet::net::http::HttpSession::Ptr& session, uint64_t slot, std::string response, bool close) {
+				std::lock_guard lock(m_mtx);
+				m_ready.emplace(slot, std::make_pair(std::move(response), close));
+				while (!m_ready.empty() && m_ready.begin()->first == m_sent) {
+					auto& [data, should_close] = m_ready.begin()->second;
+					session->send(std::move(data));
+					if (should_close)
+						session->postShutdown();
+					m_ready.erase(m_ready.begin());
+					++m_sent;
 				}
+			}
 
+		private:
+			std::mutex m_mtx;
+			uint64_t m_next = 0;
+			uint64_t m_sent = 0;
+			std::map<uint64_t, std::pair<std::string, bool>> m_ready;
 		};
+	}
 
-		auto httpHeaderCallback = [this](const HTTPParser& httpParser, const HttpSession::Ptr& httpSession) {
-			if (config.token && config.token != httpParser.getValue("Authorization").substr(sizeof("Bearer ")-1))
+	void BotInstance::start() {
+		startAsync();
+
+		while (getchar() != EOF)
+		{
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+
+		stop();
+	}
+
+	void BotInstance::startAsync() {
+		using namespace brynet::base;
+		using namespace brynet::net;
+		using namespace brynet::net::http;
+		if (context->listener)
+			return;
+		if (!context->runtime)
+			context->runtime = Runtime::create(1, 0, config.lanes, config.placement);
+		auto& runtime = context->runtime->impl();
+		if (!context->executor)
+		{
+			// 投递的任务计入tasks，stop()据此等待本实例的任务排空
+			for (std::size_t i = 0; i < context->lanes.size(); ++i)
 			{
+				auto lane = static_cast<Lane>(i);
+				context->lanes[i] = [tasks = context->tasks, lane, executor = context->runtime->executor(lane)](Job job) {
+					tasks->started();
+					executor([tasks, lane, job = std::move(job)]() mutable {
+						{
+							BotContext::LaneScope scope(lane);
+							job();
+						}
+						// job可能持有context，先释放再计数，stop()返回之后不会在事件线程上析构context
+						job = nullptr;
+						tasks->finished();
+					});
+				};
+			}
+			context->executor = context->laneExecutor(Lane::LIFECYCLE);
+			if (config.fair.has_value())
+			{
+				for (auto lane : { Lane::INTERACTIVE, Lane::NOTICE })
+					context->fair[static_cast<std::size_t>(lane)] = std::make_shared<FairScheduler>(context->laneExecutor(lane), *config.fair);
+			}
+		}
+		auto websocket_port = config.ws_port;
+		auto service = runtime.service;
+
+		// IO回调可能在实例析构之后到达，访问实例前先确认它还活着
+		// 鉴权结果按会话记录：postClose()是异步的，关闭之前已经收到的请求和帧仍然会回调，要在回调里检查
+		auto ws_enter_callback = [this, context = context](const HttpSession::Ptr& httpSession,
+			WebSocketFormat::WebSocketFrameType opcode,
+			const std::string& payload,
+			const std::shared_ptr<std::atomic<bool>>& authorized) {
+				if (!authorized->load())
+					return;
+				std::shared_lock lock(context->lifetime);
+				if (context->alive)
+					handlePayload(payload, httpSession);
+		};
+
+		auto httpHeaderCallback = [token = config.token](const HTTPParser& httpParser, const HttpSession::Ptr& httpSession, const std::shared_ptr<std::atomic<bool>>& authorized) {
+			const auto& authorization = httpParser.getValue("Authorization");
+			constexpr std::string_view bearer = "Bearer ";
+			bool ok = !token || (authorization.size() >= bearer.size() && token == authorization.substr(bearer.size()));
+			authorized->store(ok);
+			if (!ok)
 				std::cerr << "Authorization failed!" << std::endl;
-				httpSession->postClose();
+		};
+
+		// HTTP POST上报，监听器在线程池中执行，响应由PostResponder按请求顺序写回
+		auto httpPostCallback = [this, context = context](const HTTPParser& httpParser, const HttpSession::Ptr& httpSession, const std::shared_ptr<PostResponder>& responder, bool authorized) {
+			std::shared_lock lock(context->lifetime);
+			if (!context->alive)
+				return;
+			auto slot = responder->reserve();
+			// 鉴权失败的请求不解析也不派发，回复401后关闭连接
+			if (!authorized)
+			{
+				responder->complete(httpSession, slot, "HTTP/1.1 401 Unauthorized\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", true);
+				return;
 			}
-        };
+			auto keep_alive = httpParser.isKeepAlive();
+			handlePost(httpParser.getBody(), [httpSession, responder, slot, keep_alive](const EventJson&, const nlohmann::json& operation) {
+				HttpResponse response;
+				response.setStatus(HttpResponse::HTTP_RESPONSE_STATUS::OK);
+				response.setContentType("application/json");
+				response.addHeadValue("Connection", keep_alive ? "keep-alive" : "close");
+				response.setBody(operation.is_null() ? std::string("{}") : operation.dump());
+				responder->complete(httpSession, slot, response.getResult(), !keep_alive);
+			});
+		};
 
-		wrapper::HttpListenerBuilder listener_builder;
-		listener_builder
+		context->listener = std::make_unique<wrapper::HttpListenerBuilder>();
+		(*context->listener)
 			.WithService(service)
 			.AddSocketProcess([](TcpSocket& socket) {
 			socket.setNodelay();
 				})
 			.WithMaxRecvBufferSize(static_cast<size_t>(1024 * 1024 * 4))
 			.WithAddr(false, "0.0.0.0", websocket_port)
-			.WithEnterCallback([ws_enter_callback, httpHeaderCallback](const HttpSession::Ptr& httpSession, HttpSessionHandlers& handlers) {
-				handlers.setHeaderCallback(httpHeaderCallback);
-				handlers.setWSCallback(ws_enter_callback);
+			.WithEnterCallback([context = context, ws_enter_callback, httpHeaderCallback, httpPostCallback](const HttpSession::Ptr& httpSession, HttpSessionHandlers& handlers) {
+				auto authorized = std::make_shared<std::atomic<bool>>(false);
+				handlers.setHeaderCallback([httpHeaderCallback, authorized](const HTTPParser& httpParser, const HttpSession::Ptr& httpSession) {
+					httpHeaderCallback(httpParser, httpSession, authorized);
+				});
+				handlers.setWSCallback([ws_enter_callback, authorized](const HttpSession::Ptr& httpSession, WebSocketFormat::WebSocketFrameType opcode, const std::string& payload) {
+					ws_enter_callback(httpSession, opcode, payload, authorized);
+				});
+				handlers.setHttpCallback([httpPostCallback, authorized, responder = std::make_shared<PostResponder>()](const HTTPParser& httpParser, const HttpSession::Ptr& httpSession) {
+					httpPostCallback(httpParser, httpSession, responder, authorized->load());
+				});
+				handlers.setClosedCallback([context](const HttpSession::Ptr& httpSession) {
+					context->sessions.disconnect(httpSession);
+				});
 				})
             .WithReusePort()
 			.asyncRun()
 			;
 
-		while (getchar() != EOF)
+		// 正向WS，复用同一个IO服务和同一条解码派发流程
+		if (config.forward_ws_port)
 		{
-			std::this_thread::sleep_for(std::chrono::seconds(1));
+			ForwardClient::Options options{ config.host, *config.forward_ws_port, "/", config.token };
+			options.deflate = config.ws_deflate;
+			context->forward = ForwardClient::create(service, runtime.connector(), std::move(options),
+				[this, context = context](const std::string& payload, const HttpSession::Ptr& httpSession) {
+					std::shared_lock lock(context->lifetime);
+					if (context->alive)
+						handlePayload(payload, httpSession, true);
+				},
+				[context = context](const HttpSession::Ptr& httpSession) {
+					context->sessions.disconnect(httpSession);
+				});
+			context->forward->start();
+		}
+
+		// 定时器在派发开始之前恢复，重启前已经到期的持久化定时器随即执行
+		if (context->timer_store && !timers_loaded)
+		{
+			timers_loaded = true;
+			auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+			// 只加入从文件中恢复的定时器，startAsync()之前runAfterPersistent()的已经在时间轮中
+			for (auto& [key, entry] : context->timer_store->restore())
+			{
+				std::chrono::milliseconds delay(entry.due_ms - now_ms);
+				auto id = context->timers.add(delay, std::chrono::milliseconds(0), persistentJob(key, std::move(entry.name), std::move(entry.payload)));
+				context->timer_store->bind(key, id);
+			}
+		}
+		if (!context->session_sweep)
+		{
+			context->session_sweep = context->timers.add(std::chrono::seconds(1), std::chrono::seconds(1), [weak = std::weak_ptr<BotContext>(context)] {
+				if (auto context = weak.lock())
+					context->sessions.expire();
+			});
+		}
+		context->timers.start(context->laneExecutor(Lane::BACKGROUND));
+		if (context->watchdog)
+			context->watchdog->start();
+		if (context->search)
+			context->search->setExecutor(context->laneExecutor(Lane::BACKGROUND));
+		// 消费者提交的调用按提交顺序以异步模式发出，不等待响应
+		if (context->bus)
+		{
+			context->bus->start([this](uint64_t self_id, std::string_view api_name, nlohmann::json params) {
+				getApiSet(self_id).callApi(std::string(api_name), params);
+			});
 		}
 
-		pool.wait();
+		context->accepting = true;
+	}
+
+	bool BotInstance::stop(std::chrono::milliseconds timeout) {
+		if (!context->listener)
+			return true;
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+
+		// 不再接受新连接，也不再派发新事件，已有会话保持到排空结束以便接收API响应
+		context->accepting = false;
+		context->timers.stop();
+		context->listener->stop();
+		context->listener.reset();
+		if (context->forward)
+		{
+			context->forward->stop();
+			context->forward.reset();
+		}
+
+		auto drained = context->waitIdle(deadline);
+		drained = context->pending.waitEmpty(deadline) && drained;
+
+		// 排空期间卡住的监听器仍然会被报告
+		if (context->watchdog)
+			context->watchdog->stop();
+		if (context->bus)
+			context->bus->stop();
+		context->sessions.closeAll();
+		context->pending.failAll("bot instance stopped");
+		return drained;
+	}
+
+	namespace {
+		Job _timer_job(Job job) {
+			return [job = std::move(job)] {
+				try {
+					job();
+				}
+				catch (const std::exception& e) {
+					std::cerr << "Timer Exception: " << e.what() << std::endl;
+				}
+			};
+		}
+	}
+
+	BotInstance::TimerId BotInstance::runAfter(std::chrono::milliseconds delay, Job job) {
+		return context->timers.add(delay, std::chrono::milliseconds(0), _timer_job(std::move(job)));
+	}
+
+	BotInstance::TimerId BotInstance::runEvery(std::chrono::milliseconds period, Job job) {
+		return context->timers.add(period, period, _timer_job(std::move(job)));
+	}
+
+	bool BotInstance::cancel(TimerId id) {
+		if (context->timer_store)
+			context->timer_store->cancel(id);
+		return context->timers.cancel(id);
+	}
+
+	void BotInstance::onTimer(const std::string& name, std::function<void(const nlohmann::json&)> handler) {
+		timer_handlers[name] = std::move(handler);
+	}
+
+	BotInstance::TimerId BotInstance::runAfterPersistent(std::chrono::milliseconds delay, const std::string& name, nlohmann::json payload) {
+		if (!context->timer_store)
+			throw std::logic_error("runAfterPersistent requires Config::timer_store");
+		auto due = std::chrono::system_clock::now() + delay;
+		auto key = context->timer_store->put({
+			name,
+			std::chrono::duration_cast<std::chrono::milliseconds>(due.time_since_epoch()).count(),
+			payload
+		});
+		auto id = context->timers.add(delay, std::chrono::milliseconds(0), persistentJob(key, name, std::move(payload)));
+		context->timer_store->bind(key, id);
+		return id;
+	}
+
+	Job BotInstance::persistentJob(uint64_t key, std::string name, nlohmann::json payload) {
+		return [this, context = context, key, name = std::move(name), payload = std::move(payload)] {
+			std::shared_lock lock(context->lifetime);
+			if (!context->alive)
+				return;
+			auto handler = timer_handlers.find(name);
+			if (handler == timer_handlers.end())
+			{
+				std::cerr << "Timer Exception: no handler for " << name << std::endl;
+			}
+			else
+			{
+				try {
+					handler->second(payload);
+				}
+				catch (const std::exception& e) {
+					std::cerr << "Timer Exception: " << e.what() << std::endl;
+				}
+			}
+			// 处理函数结束后才从文件中删除，中途崩溃的定时器重启后会再执行一次
+			context->timer_store->erase(key);
+		};
+	}
+
+	void Task::promise_type::unhandled_exception() noexcept {
+		try {
+			throw;
+		}
+		catch (const std::exception& e) {
+			std::cerr << "Coroutine handler error: " << e.what() << std::endl;
+		}
+	}
+
+	namespace {
+		template<typename T>
+		void _sort_unique(std::vector<T>& list)
+		{
+			std::sort(list.begin(), list.end());
+			list.erase(std::unique(list.begin(), list.end()), list.end());
+		}
+
+		// allow为空表示不限制；字段缺失时只有allow名单会拒绝
+		bool _match_id(const EventJson& payload, const char* key, const std::vector<uint64_t>& allow, const std::vector<uint64_t>& deny)
+		{
+			if (allow.empty() && deny.empty())
+				return true;
+			auto it = payload.find(key);
+			if (it == payload.end() || !it->is_number_integer())
+				return allow.empty();
+			auto id = it->get<uint64_t>();
+			if (std::binary_search(deny.begin(), deny.end(), id))
+				return false;
+			return allow.empty() || std::binary_search(allow.begin(), allow.end(), id);
+		}
+	}
+
+	void Event::Filter::normalize() {
+		_sort_unique(group_allow);
+		_sort_unique(group_deny);
+		_sort_unique(user_allow);
+		_sort_unique(user_deny);
+		_sort_unique(self_allow);
+		_sort_unique(sub_type);
+	}
+
+	bool Event::Filter::match(const EventJson& payload) const {
+		if (!_match_id(payload, "self_id", self_allow, {})
+			|| !_match_id(payload, "group_id", group_allow, group_deny)
+			|| !_match_id(payload, "user_id", user_allow, user_deny))
+			return false;
+		if (sub_type.empty())
+			return true;
+		auto it = payload.find("sub_type");
+		if (it == payload.end() || !it->is_string())
+			return false;
+		const auto& value = it->get_ref<const std::string&>();
+		return std::binary_search(sub_type.begin(), sub_type.end(), value);
 	}
 
 	template<Event::Concept T>
@@ -9,7 +9,20 @@
 #include <nlohmann/json.hpp>
 #include <variant>
 #include <concepts>
-#include <future>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <coroutine>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <chrono>
+#include <map>
+#include <array>
+
+namespace brynet::net::http {
+    class HttpSession;
+};
 
 namespace twobot
 {
@@ -36,14 +49,516 @@ namespace std{
 
 namespace twobot {
 
+    namespace _ {
+        void* eventAllocate(std::size_t size);
+        void eventDeallocate(void* ptr) noexcept;
+    };
+
+    // 事件json的分配器，IO线程解码时若开启了Config::event_arena，节点从该事件独占的单调内存池分配，
+    // 随事件整体回收；其余情况(包括监听器里的拷贝)走全局堆
+    template<typename T>
+    struct EventAllocator {
+        using value_type = T;
+
+        EventAllocator() noexcept = default;
+        template<typename U>
+        EventAllocator(const EventAllocator<U>&) noexcept {}
+
+        T* allocate(std::size_t n) {
+            return static_cast<T*>(_::eventAllocate(n * sizeof(T)));
+        }
+        void deallocate(T* ptr, std::size_t) noexcept {
+            _::eventDeallocate(ptr);
+        }
+
+        template<typename U>
+        bool operator==(const EventAllocator<U>&) const noexcept { return true; }
+        template<typename U>
+        bool operator!=(const EventAllocator<U>&) const noexcept { return false; }
+    };
+
+    // 事件原始json的类型，可以隐式转换为nlohmann::json
+    using EventJson = nlohmann::basic_json<std::map, std::vector, std::string, bool, std::int64_t, std::uint64_t, double, EventAllocator>;
+
+    // EventJson的分配统计，heap / events 即每个事件的堆分配次数
+    struct EventAllocStats {
+        uint64_t events;
+        uint64_t heap;
+        uint64_t arena;
+    };
+
+    EventAllocStats getEventAllocStats();
+
+    using Job = std::function<void()>;
+    // 执行器，负责把任务投递到事件线程池
+    using Executor = std::function<void(Job)>;
+
+    // 异步结果的共享状态，由结果的生产者完成，完成时调用续体
+    template<typename T>
+    struct SharedState {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::optional<T> value = std::nullopt;
+        std::exception_ptr error = nullptr;
+        Job continuation{};  // 完成时在完成结果的线程上直接调用，只保存一个
+        Executor executor{}; // 等待者恢复时使用的执行器，为空则在完成结果的线程上直接执行
+
+        bool done() const { return value.has_value() || error != nullptr; }
+
+        void set(T v) {
+            complete([&] { value = std::move(v); });
+        }
+
+        void setError(std::exception_ptr e) {
+            complete([&] { error = std::move(e); });
+        }
+
+        // 已经完成时返回false，续体不会被保存
+        bool setContinuation(Job cont) {
+            std::lock_guard lock(mtx);
+            if (done())
+                return false;
+            continuation = std::move(cont);
+            return true;
+        }
+
+        void schedule(Job job) {
+            if (executor)
+                executor(std::move(job));
+            else
+                job();
+        }
+
+        T take() {
+            if (error)
+                std::rethrow_exception(error);
+            return std::move(*value);
+        }
+
+    private:
+        template<typename F>
+        void complete(F&& store) {
+            Job cont;
+            {
+                std::lock_guard lock(mtx);
+                store();
+                cont = std::move(continuation);
+            }
+            cv.notify_all();
+            if (cont)
+                cont();
+        }
+    };
+
+    // 异步结果，接口与std::future一致，另外支持co_await和then()续体
+    template<typename T>
+    class Future {
+    public:
+        using State = SharedState<T>;
+
+        Future() = default;
+        explicit Future(std::shared_ptr<State> state) : m_state(std::move(state)) {}
+        Future(Future&&) noexcept = default;
+        Future& operator=(Future&&) noexcept = default;
+
+        bool valid() const { return m_state != nullptr; }
+
+        bool ready() const {
+            std::lock_guard lock(m_state->mtx);
+            return m_state->done();
+        }
+
+        void wait() const {
+            std::unique_lock lock(m_state->mtx);
+            m_state->cv.wait(lock, [this] { return m_state->done(); });
+        }
+
+        // [阻塞] 等待并取出结果，之后Future不再有效
+        T get() {
+            wait();
+            auto state = std::move(m_state);
+            return state->take();
+        }
+
+        const Executor& getExecutor() const { return m_state->executor; }
+
+        // 完成时在完成结果的线程上调用fn(std::shared_ptr<State>)，之后Future不再有效，供组合子使用
+        template<typename F>
+        void onComplete(F fn) {
+            auto state = std::move(m_state);
+            auto job = [state, fn = std::move(fn)]() mutable { fn(state); };
+            if (!state->setContinuation(job))
+                job();
+        }
+
+        // 完成后在executor上调用fn(T)，executor为空则使用本结果的执行器，返回fn结果的Future(fn返回void时为std::monostate)
+        template<typename F, typename R = std::invoke_result_t<F, T>>
+        auto then(F fn, Executor executor = {}) {
+            using V = std::conditional_t<std::is_void_v<R>, std::monostate, R>;
+            auto next = std::make_shared<SharedState<V>>();
+            next->executor = executor ? std::move(executor) : m_state->executor;
+            onComplete([next, fn = std::move(fn)](std::shared_ptr<State> state) mutable {
+                next->schedule([next, state, fn = std::move(fn)]() mutable {
+                    try {
+                        if constexpr (std::is_void_v<R>) {
+                            fn(state->take());
+                            next->set({});
+                        }
+                        else {
+                            next->set(fn(state->take()));
+                        }
+                    }
+                    catch (...) {
+                        next->setError(std::current_exception());
+                    }
+                });
+            });
+            return Future<V>(std::move(next));
+        }
+
+        bool await_ready() const { return ready(); }
+
+        // 结果完成后在执行器上恢复协程
+        bool await_suspend(std::coroutine_handle<> handle) {
+            auto state = m_state.get();
+            return state->setContinuation([state, handle] {
+                state->schedule([handle] { handle.resume(); });
+            });
+        }
+
+        T await_resume() {
+            auto state = std::move(m_state);
+            return state->take();
+        }
+
+        // 已经完成的结果
+        static Future fromValue(T value) {
+            auto state = std::make_shared<State>();
+            state->value = std::move(value);
+            return Future(std::move(state));
+        }
+
+    protected:
+        std::shared_ptr<State> m_state;
+    };
+
+    // 全部完成后得到按原顺序排列的结果，任意一个失败则整体失败
+    // executor为空则使用第一个结果的执行器
+    template<typename T>
+    Future<std::vector<T>> whenAll(std::vector<Future<T>> futures, Executor executor = {}) {
+        struct Join {
+            std::mutex mtx;
+            std::vector<std::optional<T>> values;
+            std::exception_ptr error = nullptr;
+            std::size_t remaining;
+        };
+        auto next = std::make_shared<SharedState<std::vector<T>>>();
+        if (futures.empty()) {
+            next->value.emplace();
+            return Future<std::vector<T>>(std::move(next));
+        }
+        next->executor = executor ? std::move(executor) : futures.front().getExecutor();
+        auto join = std::make_shared<Join>();
+        join->values.resize(futures.size());
+        join->remaining = futures.size();
+        for (std::size_t i = 0; i < futures.size(); ++i) {
+            futures[i].onComplete([join, next, i](std::shared_ptr<SharedState<T>> state) {
+                std::unique_lock lock(join->mtx);
+                if (state->error)
+                    join->error = join->error ? join->error : state->error;
+                else
+                    join->values[i] = std::move(state->value);
+                if (--join->remaining != 0)
+                    return;
+                lock.unlock();
+                if (join->error) {
+                    next->setError(join->error);
+                    return;
+                }
+                std::vector<T> values;
+                values.reserve(join->values.size());
+                for (auto& value : join->values)
+                    values.push_back(std::move(*value));
+                next->set(std::move(values));
+            });
+        }
+        return Future<std::vector<T>>(std::move(next));
+    }
+
+    template<typename T, typename... Ts>
+        requires (std::same_as<Ts, Future<T>> && ...)
+    Future<std::vector<T>> whenAll(Future<T> first, Ts... rest) {
+        std::vector<Future<T>> futures;
+        futures.reserve(1 + sizeof...(rest));
+        futures.push_back(std::move(first));
+        (futures.push_back(std::move(rest)), ...);
+        return whenAll(std::move(futures));
+    }
+
+    // 任意一个完成即完成，结果为{下标, 结果}，其余结果被丢弃
+    template<typename T>
+    Future<std::pair<std::size_t, T>> whenAny(std::vector<Future<T>> futures, Executor executor = {}) {
+        auto next = std::make_shared<SharedState<std::pair<std::size_t, T>>>();
+        if (futures.empty()) {
+            next->setError(std::make_exception_ptr(std::invalid_argument("whenAny: empty input")));
+            return Future<std::pair<std::size_t, T>>(std::move(next));
+        }
+        next->executor = executor ? std::move(executor) : futures.front().getExecutor();
+        auto claimed = std::make_shared<std::atomic_flag>();
+        for (std::size_t i = 0; i < futures.size(); ++i) {
+            futures[i].onComplete([claimed, next, i](std::shared_ptr<SharedState<T>> state) {
+                if (claimed->test_and_set())
+                    return;
+                if (state->error)
+                    next->setError(state->error);
+                else
+                    next->set({ i, std::move(*state->value) });
+            });
+        }
+        return Future<std::pair<std::size_t, T>>(std::move(next));
+    }
+
+    // 协程事件处理函数的返回类型，协程立即开始执行，结束后自动销毁
+    struct Task {
+        struct promise_type {
+            Task get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept;
+        };
+    };
+
+    // 机器人实例与ApiSet共享的运行时状态
+    struct BotContext;
+    class EventArena;
+    class EventTrace;
+
+    // 事件派发通道，线程空闲时TBB在各通道之间窃取任务，繁忙时高优先级通道先得到线程
+    enum class Lane {
+        LIFECYCLE,   // 元事件、连接事件，以及不在通道任务中发起的API调用的续体
+        INTERACTIVE, // 消息事件
+        NOTICE,      // 通知和请求事件
+        BACKGROUND,  // 定时器、批量调用和广播
+    };
+
+    struct LaneConfig {
+        int concurrency; // 该通道最多同时占用的线程数，0表示不限制
+        enum class Priority {
+            LOW,
+            NORMAL,
+            HIGH,
+        } priority;
+    };
+
+    // 下标为Lane
+    using LaneConfigs = std::array<LaneConfig, 4>;
+
+    // 线程放置，CPU编号从0开始，列表为空表示不限制
+    // 把IO线程和事件线程放在同一个NUMA节点的CPU上，解码和处理之间的数据就不会跨节点
+    // 一个会话的事件并不固定在解码它的核上处理，这里只在节点级别近似：事件线程可能运行在同一节点的任意worker_cpus上
+    // 效果可以用TwoBot-placement-bench比较
+    struct Placement {
+        std::vector<int> io_cpus;     // 第i个IO线程绑定到io_cpus[i % size]
+        std::vector<int> worker_cpus; // 事件线程(线程池或各通道的TBB线程)限制在这些CPU上
+        int numa_node = -1;           // 各通道的task arena限制在该NUMA节点上，需要tbbbind，-1表示不限制
+    };
+
+    // 延迟追踪的设置，每sample_every个事件记录一个，最多保留最近capacity个
+    struct TraceConfig {
+        std::size_t capacity = 1024;
+        uint32_t sample_every = 1;
+    };
+
+    // 按账号公平调度的设置
+    struct FairConfig {
+        std::size_t concurrency;           // 所有账号合计同时执行的事件数
+        std::size_t per_account;           // 单个账号同时执行的事件数上限
+        std::chrono::microseconds quantum; // 每一轮补充给每个账号的处理时间额度
+    };
+
+    // 单个账号的调度统计，只在启用公平调度时有数据
+    struct TenantStats {
+        std::size_t queued = 0;    // 排队中的事件数
+        std::size_t running = 0;   // 正在执行的事件数
+        uint64_t handled = 0;      // 已处理的事件数
+        double handler_ms_avg = 0; // 处理耗时的滑动平均
+        double handler_ms_total = 0;
+    };
+
+    // 监听器耗时监控的设置
+    struct WatchdogConfig {
+        std::chrono::milliseconds budget{ 1000 };  // 没有单独设置预算的监听器使用的预算
+        std::chrono::milliseconds interval{ 100 }; // 检查正在执行的监听器的间隔
+        uint32_t quarantine_after = 0;             // 连续超出预算这么多次后移到BACKGROUND通道，0表示不隔离
+        std::chrono::milliseconds quarantine_for{ 60000 }; // 隔离这么久之后放回原来的通道，随后的quarantine_after次执行中再超出预算立即重新隔离；0表示一直隔离
+    };
+
+    // 单个事件类型的监听器耗时统计，分位数按对数分桶估算
+    struct HandlerStats {
+        uint64_t calls = 0;       // 已结束的执行次数
+        uint64_t over_budget = 0; // 超出预算的次数
+        double budget_ms = 0;
+        double p50_ms = 0;
+        double p90_ms = 0;
+        double p99_ms = 0;
+        double max_ms = 0;
+        bool quarantined = false; // 是否已被隔离到BACKGROUND通道
+    };
+
+    // 事件去重的设置，用于实现端重连后重放或者同一账号通过多个连接上报的场景
+    struct DedupConfig {
+        std::chrono::milliseconds window{ 60000 }; // 在这个时间内重复到达的事件会被丢弃
+        std::size_t capacity = 65536;              // 每个窗口内预计的事件数，决定内存占用(约8字节每个)
+    };
+
+    // 消息存储的设置
+    struct MessageStoreConfig {
+        std::string path;                             // 段文件所在的目录，不存在时创建
+        std::size_t segment_size = 64 * 1024 * 1024;  // 每个段文件的大小，写满后换到下一个段
+        std::size_t max_segments = 16;                // 最多保留的段数，超出时删除最旧的段
+        std::chrono::seconds retention{ 7 * 24 * 3600 }; // 段内最新的消息早于这个时间时整段删除，0表示只按段数淘汰
+    };
+
+    // 存储中的一条消息，raw指向映射的段文件，只在查询的回调内有效
+    struct StoredMessage {
+        uint64_t self_id;
+        int64_t message_id;
+        uint64_t group_id; // 私聊为0
+        uint64_t user_id;
+        int64_t time;
+        std::string_view raw; // 上报的原始json
+    };
+
+    // 撤回缓存的设置，每个会话(群或好友)占用约bytes + messages * 40字节
+    struct RecallCacheConfig {
+        std::size_t messages = 128;               // 每个会话缓存的最近消息条数
+        std::size_t bytes = 16 * 1024;            // 每个会话缓存消息内容的字节数，比这更长的消息不缓存
+        std::chrono::seconds max_age{ 600 };      // 撤回时原消息超过这个时间的不再附带
+        std::size_t conversations = 1024;         // 最多缓存的会话数，超出时淘汰最久没有消息的会话
+    };
+
+    // 全文索引的设置
+    struct SearchConfig {
+        std::size_t batch = 4096;                         // 缓冲段积累这么多条消息后冻结，并按需合并
+        std::chrono::seconds retention{ 30 * 24 * 3600 }; // 早于这个时间的消息在合并时移出索引，0表示一直保留
+    };
+
+    // 全文检索的查询，text中以空格分隔的条件都要满足，OR分隔的部分满足任一即可，
+    // 引号内为短语，以-开头的条件表示排除，例如：退款 "订单号" -测试 OR refund
+    struct SearchQuery {
+        std::string text;
+        std::vector<uint64_t> group_ids{}; // 只在这些群中查找，为空表示所有群和私聊
+        int64_t from = 0;                  // 消息时间的范围，秒级时间戳，包含两端
+        int64_t to = INT64_MAX;
+        std::size_t limit = 100;           // 最多返回的条数，按时间从新到旧
+    };
+
+    // 命中的消息，内容可以通过BotInstance::findMessage或getMsg取得
+    struct SearchHit {
+        uint64_t self_id;
+        int64_t message_id;
+        uint64_t group_id; // 私聊为0
+        uint64_t user_id;
+        int64_t time;
+    };
+
+    // 正向WS的permessage-deflate压缩，握手时协商，双方都支持时我方按threshold压缩发送的消息
+    struct DeflateConfig {
+        bool client_no_context_takeover = false; // 我方每条消息重置压缩上下文，内存占用小但压缩率低
+        bool server_no_context_takeover = false; // 要求对端每条消息重置压缩上下文
+        int client_max_window_bits = 15;         // 我方压缩的窗口大小，9~15
+        int server_max_window_bits = 15;         // 要求对端压缩的窗口大小，9~15
+        int level = 6;                           // zlib压缩级别，1最快，9压缩率最高
+        std::size_t threshold = 256;             // 短于这个长度的消息不压缩
+    };
+
+    // 共享内存事件总线，其他进程中的监听器通过BusConsumer订阅事件并提交API调用
+    struct EventBusConfig {
+        std::string name = "twobot";                 // 共享内存的名字，消费者按这个名字连接
+        std::size_t capacity = 16 * 1024 * 1024;     // 事件环的字节数，向上取2的幂，落后超过一圈的消费者丢弃未读的事件
+        std::size_t action_capacity = 1024 * 1024;   // 每个消费者提交API调用的环的字节数，向上取2的幂
+    };
+
     // 服务器配置
     struct Config{
         std::string host;
         std::uint16_t  api_port;
         std::uint16_t  ws_port;
         std::optional<std::string> token;
+        std::size_t send_queue_size = 1024; // 每个机器人在重连期间最多缓存的待发送帧数
+        std::chrono::milliseconds send_queue_timeout{ 30000 }; // 缓存的帧最多等待这么久，超过这个时间仍未重连的机器人被移除
+        std::optional<std::uint16_t> forward_ws_port = std::nullopt; // 设置后主动连接host上的OneBot正向WS，事件和API复用这条连接
+        bool event_arena = false; // 事件json从每个事件独占的内存池分配，事件销毁时整体回收
+        double api_rate_limit = 0; // 批量调用和广播每秒最多发出的请求数，0表示不限制
+        std::optional<std::string> timer_store = std::nullopt; // 持久化定时器的存储文件
+        // 设置后事件按通道派发到各自的TBB task arena，否则全部进入一个FIFO线程池；共享Runtime时以创建Runtime时的设置为准
+        std::optional<LaneConfigs> lanes = std::nullopt;
+        // 设置后消息和通知事件按self_id分别排队，按处理耗时做赤字轮转(DRR)，一个账号刷屏不会拖慢其他账号
+        std::optional<FairConfig> fair = std::nullopt;
+        Placement placement{}; // 共享Runtime时以创建Runtime时的设置为准
+        std::optional<TraceConfig> trace = std::nullopt; // 为空时不追踪
+        std::optional<WatchdogConfig> watchdog = std::nullopt; // 为空时不统计监听器耗时
+        std::optional<DedupConfig> dedup = std::nullopt; // 设置后丢弃窗口内重复的消息、通知和请求事件，元事件不去重
+        std::optional<MessageStoreConfig> message_store = std::nullopt; // 设置后解码出的私聊和群消息都写入消息存储，不需要注册监听器
+        std::optional<RecallCacheConfig> recall_cache = std::nullopt; // 设置后撤回通知带上缓存的原消息
+        std::optional<SearchConfig> search = std::nullopt; // 设置后为收到的消息建立全文索引，同时设置了message_store时启动时从中重建
+        std::optional<DeflateConfig> ws_deflate = std::nullopt; // 只用于正向WS，握手时请求permessage-deflate；协商成功后收到的消息都按压缩过的解压，对端不能对短消息跳过压缩
+        std::optional<EventBusConfig> event_bus = std::nullopt; // 设置后有消费者订阅的事件同时发布到共享内存事件总线
+    };
+
+    // Api调用的传输通道
+    enum class Transport {
+        WEBSOCKET,
+        HTTP,
+    };
+
+    // 单个传输通道的调用统计，延迟和错误率为指数滑动平均
+    struct TransportStats {
+        uint64_t calls = 0;
+        uint64_t errors = 0;
+        double latency_ms = 0;
+        double error_rate = 0;
+    };
+
+    // 机器人反向WS会话的连接状态
+    enum class ConnState {
+        DISCONNECTED, // 从未连接
+        CONNECTED,    // 会话可用
+        RECONNECTING, // 会话已断开，等待重连，期间的异步调用进入队列
     };
 
+    namespace Event {
+        // 消息发送者，私聊消息只有user_id、nickname、sex、age，其余字段只有群消息才有
+        // 常见的昵称和群名片不超过std::string的短字符串容量，不会产生堆分配
+        struct Sender {
+            uint64_t user_id = 0; // 发送者QQ号
+            std::string nickname; // 昵称
+            std::string card;     // 群名片／备注
+            enum ROLE {
+                NONE,   // 私聊或未知
+                OWNER,  // 群主
+                ADMIN,  // 管理员
+                MEMBER  // 群员
+            } role = NONE; // 群角色
+            enum SEX {
+                UNKNOWN,
+                MALE,
+                FEMALE
+            } sex = UNKNOWN; // 性别
+            int32_t age = 0;   // 年龄
+            std::string level; // 群成员等级
+            std::string title; // 专属头衔
+        };
+
+        // 撤回通知附带的原消息，来自Config::recall_cache
+        struct RecalledMessage {
+            uint64_t user_id = 0; // 发送者QQ
+            int64_t time = 0;     // 原消息的发送时间
+            std::string message;  // 原消息的raw_message
+        };
+    }
+
     // Api集合，所有对机器人调用的接口都在这里
     struct ApiSet{
 
@@ -51,7 +566,9 @@ namespace twobot {
 
 		struct SyncMode { bool isPost; };
 		struct AsyncMode { bool needResp; };
-        using ApiMode = std::variant<SyncMode, AsyncMode>;
+        // 机器人有可用的WS会话时走WS，否则回落到HTTP POST，两者都可用时按各自的延迟和错误率选择
+        struct AutoMode {};
+        using ApiMode = std::variant<SyncMode, AsyncMode, AutoMode>;
 
         struct SyncConfig {
             std::string host;
@@ -59,13 +576,86 @@ namespace twobot {
             std::optional<std::string> token;
         };
         struct AsyncConfig { uint64_t id; };
-        using ApiConfig = std::variant<SyncConfig, AsyncConfig>;
+        struct AutoConfig { uint64_t id; SyncConfig http; };
+        using ApiConfig = std::variant<SyncConfig, AsyncConfig, AutoConfig>;
 
+        // first为调用是否成功，按响应的retcode/status判断；second在WS下为响应的data，HTTP下为整个响应
         using SyncResult = std::pair<bool, nlohmann::json>;
-        using ApiResult = std::future<SyncResult>;
+        // 可以get()阻塞等待，可以在协程中co_await，也可以用then()/whenAll()/whenAny()组合
+        using ApiResult = Future<SyncResult>;
         // 万api之母，负责提起所有的api的请求
         ApiResult callApi(const std::string &api_name, const nlohmann::json &data);
 
+        // 流式调用，响应的data数组每扫描出一个元素就回调一次，不构造整个响应的DOM，结果中的data为空数组
+        // HTTP下总是以GET请求、在调用线程上回调；WS下在LIFECYCLE通道上按元素顺序回调
+        using ElementCallback = std::function<void(std::string_view element)>;
+        ApiResult callApiStream(const std::string &api_name, const nlohmann::json &data, ElementCallback callback);
+
+        // 参数已经序列化成json对象字符串的调用，同步模式下总是POST
+        ApiResult callApiRaw(const std::string &api_name, const std::string &params);
+
+        // 批量调用，最多window个请求同时在途，发送节奏服从Config::api_rate_limit
+        struct BatchOptions {
+            std::size_t window;
+            // 每个目标占用发送配额之前调用，返回true时跳过该目标，以"cancelled"失败结束
+            std::function<bool(uint64_t target)> skip;
+        };
+        struct BatchItem {
+            uint64_t target;
+            SyncResult result;
+        };
+        // 每个目标的结果按传入顺序排列
+        struct BatchReport {
+            std::vector<BatchItem> items;
+            std::size_t succeeded = 0;
+            std::size_t failed = 0;
+        };
+        using BatchResult = Future<BatchReport>;
+        using BatchCall = std::function<ApiResult(ApiSet& api, uint64_t target)>;
+
+        // 对每个目标调用一次call，AsyncMode下总是等待响应
+        // 同步模式下请求在运行时的HTTP线程中执行，同时在途的请求不超过HTTP线程数(8)
+        BatchResult callApiBatch(const std::vector<uint64_t>& targets, BatchCall call, BatchOptions options = { 8 });
+
+        struct BroadcastProgress {
+            std::size_t total = 0;     // 本次需要发送的群数，不含断点文件中已完成的
+            std::size_t done = 0;
+            std::size_t succeeded = 0;
+            std::size_t failed = 0;
+        };
+        struct BroadcastOptions {
+            std::size_t window;
+            // 非空时每发送成功一个群就把群号追加到该文件，再次广播时跳过其中的群，用于崩溃或重启后续发；全部成功后删除
+            std::string checkpoint;
+            // 每个群完成后在完成它的线程上调用
+            std::function<void(const BroadcastProgress&)> on_progress;
+        };
+        // 广播的控制句柄，可以在任意线程上查询进度或取消，取消后尚未发出的群以"cancelled"失败结束
+        class BroadcastControl {
+        public:
+            void cancel() { m_cancelled = true; }
+            bool cancelled() const { return m_cancelled; }
+            BroadcastProgress progress() const {
+                return { m_total, m_done.load(), m_succeeded.load(), m_failed.load() };
+            }
+
+        private:
+            friend struct ApiSet;
+            std::size_t m_total = 0;
+            std::atomic<std::size_t> m_done{ 0 };
+            std::atomic<std::size_t> m_succeeded{ 0 };
+            std::atomic<std::size_t> m_failed{ 0 };
+            std::atomic<bool> m_cancelled{ false };
+            std::mutex m_checkpointMtx;
+        };
+        struct Broadcast {
+            std::shared_ptr<BroadcastControl> control;
+            BatchResult result;
+        };
+
+        // 向多个群发送同一条消息，消息只序列化一次，每个群只拼接group_id，节奏服从window和Config::api_rate_limit
+        Broadcast broadcastGroupMsg(const std::vector<uint64_t>& group_ids, const std::string& message, bool auto_escape = false, BroadcastOptions options = { 8 });
+
         // 下面要实现onebot标准的所有api
 
         /** 
@@ -118,6 +708,9 @@ namespace twobot {
         无
         */
         ApiResult deleteMsg(uint32_t message_id);
+
+        // 批量撤回消息，报告中的target为message_id
+        BatchResult deleteMsgBatch(const std::vector<uint32_t>& message_ids, BatchOptions options = { 8 });
         
         /**
         get_msg 获取消息
@@ -169,6 +762,9 @@ namespace twobot {
         */
         ApiResult setGroupKick(uint64_t group_id, uint64_t user_id, bool reject_add_request = false);
 
+        // 批量踢出群成员
+        BatchResult setGroupKickBatch(uint64_t group_id, const std::vector<uint64_t>& user_ids, bool reject_add_request = false, BatchOptions options = { 8 });
+
         /**
         set_group_ban 群组单人禁言
         参数
@@ -181,6 +777,9 @@ namespace twobot {
         */
         ApiResult setGroupBan(uint64_t group_id, uint64_t user_id, uint32_t duration = 30 * 60);
 
+        // 批量禁言，duration为0时批量解除禁言
+        BatchResult setGroupBanBatch(uint64_t group_id, const std::vector<uint64_t>& user_ids, uint32_t duration = 30 * 60, BatchOptions options = { 8 });
+
         /** 
         set_group_anonymous_ban 群组匿名用户禁言
         参数
@@ -344,6 +943,14 @@ namespace twobot {
         */
         ApiResult getFriendList();
 
+        struct FriendInfo {
+            uint64_t user_id = 0;
+            std::string nickname;
+            std::string remark;
+        };
+        // 流式获取好友列表，每个好友回调一次
+        ApiResult getFriendList(std::function<void(const FriendInfo&)> callback);
+
         /**
         get_group_info 获取群信息
         参数
@@ -369,6 +976,15 @@ namespace twobot {
         */
         ApiResult getGroupList();
 
+        struct GroupInfo {
+            uint64_t group_id = 0;
+            std::string group_name;
+            int32_t member_count = 0;
+            int32_t max_member_count = 0;
+        };
+        // 流式获取群列表，每个群回调一次
+        ApiResult getGroupList(std::function<void(const GroupInfo&)> callback);
+
         /**
         get_group_member_info 获取群成员信息
         参数
@@ -406,6 +1022,26 @@ namespace twobot {
         */
         ApiResult getGroupMemberList(uint64_t group_id);
 
+        struct GroupMemberInfo {
+            uint64_t group_id = 0;
+            uint64_t user_id = 0;
+            std::string nickname;
+            std::string card;
+            Event::Sender::SEX sex = Event::Sender::UNKNOWN;
+            int32_t age = 0;
+            std::string area;
+            int32_t join_time = 0;
+            int32_t last_sent_time = 0;
+            std::string level;
+            Event::Sender::ROLE role = Event::Sender::NONE;
+            bool unfriendly = false;
+            std::string title;
+            int32_t title_expire_time = 0;
+            bool card_changeable = false;
+        };
+        // 流式获取群成员列表，每个成员回调一次，几千人的大群也不会一次性构造整个成员列表
+        ApiResult getGroupMemberList(uint64_t group_id, std::function<void(const GroupMemberInfo&)> callback);
+
         /**
         get_group_honor_info 获取群荣誉信息
         参数
@@ -573,9 +1209,10 @@ namespace twobot {
         */
         ApiResult cleanCache();
     protected:
-		ApiSet(const ApiConfig& config, const ApiMode& mode);
+		ApiSet(const ApiConfig& config, const ApiMode& mode, std::shared_ptr<BotContext> ctx);
         ApiConfig m_config;
         ApiMode m_mode;
+        std::shared_ptr<BotContext> m_ctx;
         friend class BotInstance;
     };
 
@@ -606,9 +1243,12 @@ namespace twobot {
                 OTHER   // 其他
             } sub_type; //消息子类型
 
-            nlohmann::json sender; // 日后进一步处理
+            Sender sender; // 发送人信息
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
+
+            // 发送人的原始json，需要Sender以外的字段时使用
+            const EventJson& senderJson() const { return raw_msg.at("sender"); }
         };
 
         struct GroupMsg {
@@ -629,9 +1269,12 @@ namespace twobot {
                 NOTICE,     // 通知消息，如 管理员已禁止群内匿名聊天
             } sub_type; //消息子类型
 
-            nlohmann::json sender; // 日后进一步处理
+            Sender sender; // 发送人信息
+
+            EventJson raw_msg;
 
-            nlohmann::json raw_msg;
+            // 发送人的原始json，需要Sender以外的字段时使用
+            const EventJson& senderJson() const { return raw_msg.at("sender"); }
         };
 
         struct EnableEvent {
@@ -641,7 +1284,7 @@ namespace twobot {
             uint64_t time; // 事件产生的时间
             uint64_t self_id; // 机器人自身QQ
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         struct DisableEvent {
@@ -651,7 +1294,7 @@ namespace twobot {
             uint64_t time; // 事件产生的时间
             uint64_t self_id; // 机器人自身QQ
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         struct ConnectEvent {
@@ -661,7 +1304,7 @@ namespace twobot {
             uint64_t time; // 事件产生的时间
             uint64_t self_id; // 机器人自身QQ
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         struct GroupUploadNotice {
@@ -675,7 +1318,7 @@ namespace twobot {
             uint64_t user_id; // 上传文件的人的QQ
             nlohmann::json file; // 上传的文件信息,日后再进一步解析
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         struct GroupAdminNotice {
@@ -692,7 +1335,7 @@ namespace twobot {
                 UNSET,
             } sub_type; // 事件子类型，分别表示设置和取消设置
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         struct GroupDecreaseNotice {
@@ -711,7 +1354,7 @@ namespace twobot {
                 KICK_ME,    // 机器人被踢出
             } sub_type; // 事件子类型，分别表示主动退群、成员被踢、登录号被踢
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         struct GroupInceaseNotice {
@@ -728,7 +1371,7 @@ namespace twobot {
                 INVITE,  // 邀请入群
             } sub_type; // 事件子类型，分别表示管理员已同意入群、管理员邀请入群
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         struct GroupBanNotice {
@@ -746,7 +1389,7 @@ namespace twobot {
                 LIFT_BAN, // 解除禁言
             } sub_type; // 事件子类型，分别表示禁言、解除禁言
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         struct FriendAddNotice {
@@ -757,7 +1400,7 @@ namespace twobot {
             uint64_t self_id; // 机器人自身QQ
             uint64_t user_id; // 新添加好友 QQ 号
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         // 群消息撤回事件
@@ -771,9 +1414,9 @@ namespace twobot {
             uint64_t message_id; // 消息ID
             uint64_t user_id; // 发送者QQ
             uint64_t operator_id; // 操作者QQ
-        
+            std::optional<RecalledMessage> original = std::nullopt; // 启用撤回缓存且原消息还在缓存中时有效
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         // 好友消息撤回事件
@@ -785,8 +1428,9 @@ namespace twobot {
             uint64_t self_id; // 机器人自身QQ
             uint64_t user_id; // 发送者QQ
             uint64_t message_id; // 消息ID
+            std::optional<RecalledMessage> original = std::nullopt; // 启用撤回缓存且原消息还在缓存中时有效
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         // 群内通知事件，如戳一戳、群红包运气王、群成员荣誉变更
@@ -811,7 +1455,7 @@ namespace twobot {
             };
             std::optional<HonorType> honor_type = std::nullopt; // 荣誉类型
 
-            nlohmann::json raw_msg;
+            EventJson raw_msg;
         };
 
         using Variant = std::variant<
@@ -832,37 +1476,174 @@ namespace twobot {
         >;
 
         std::optional<Variant> construct(const EventType& evnet);
+
+        // 事件过滤器，在IO线程完成事件分类后立即求值，未通过的事件不会被解码，也不会进入线程池
+        // 各名单在注册时排序去重，匹配时二分查找；allow名单为空表示不限制，事件缺少对应字段时allow名单视为不匹配
+        struct Filter {
+            std::vector<uint64_t> group_allow{}; // 只接收这些群的事件
+            std::vector<uint64_t> group_deny{};  // 丢弃这些群的事件
+            std::vector<uint64_t> user_allow{};  // 只接收这些用户的事件
+            std::vector<uint64_t> user_deny{};   // 丢弃这些用户的事件
+            std::vector<uint64_t> self_allow{};  // 只接收这些机器人QQ的事件
+            std::vector<std::string> sub_type{}; // 只接收这些子类型的事件(sub_type字段)，如 friend、normal
+
+            // 排序去重，onEvent注册时会自动调用
+            void normalize();
+            // 对原始事件json求值，要求已经normalize
+            bool match(const EventJson& payload) const;
+        };
     }
 
+    /// IO服务和事件线程池，可以被多个BotInstance共享，最后一个持有者释放时停止所有线程
+    class Runtime {
+    public:
+        struct Impl;
+
+        // io_threads为IO线程数，worker_threads为事件线程池大小，0表示使用硬件线程数
+        // 设置lanes时各通道使用TBB的全局线程，worker_threads不再起作用
+        static std::shared_ptr<Runtime> create(std::size_t io_threads = 1, std::size_t worker_threads = 0, std::optional<LaneConfigs> lanes = std::nullopt, Placement placement = {});
+        ~Runtime();
+
+        // 执行器不延长运行时的生命周期，Runtime析构之后投递的任务被丢弃
+        Executor executor(Lane lane = Lane::INTERACTIVE);
+        Impl& impl() const { return *m_impl; }
+
+    private:
+        struct Gate;
+
+        explicit Runtime(std::unique_ptr<Impl> impl);
+        std::unique_ptr<Impl> m_impl;
+        std::shared_ptr<Gate> m_gate;
+    };
+
     /// BotInstance是一个机器人实例，机器人实例必须通过BotInstance::createInstance()创建
     /// 因为采用了unique_ptr，所以必须通过std::move传递，可以99.99999%避免内存泄漏
     struct BotInstance{
         // 消息类型
-        // 消息回调函数原型
-		using Callback = std::function<void(const Event::Variant&)>;
-
+        // 消息回调函数原型，返回OneBot快速操作(如{"reply": "..."})，null表示不做快速操作
+		using Callback = std::function<nlohmann::json(const Event::Variant&)>;
+        struct Handler {
+            Callback callback;
+            Event::Filter filter;
+        };
 
-        // 创建机器人实例
-        static std::unique_ptr<BotInstance> createInstance(const Config &config);
+        // 创建机器人实例，runtime为空时在启动时创建独占的Runtime
+        static std::unique_ptr<BotInstance> createInstance(const Config &config, std::shared_ptr<Runtime> runtime = nullptr);
         
         // 获取Api集合
 		ApiSet getApiSet(const uint64_t& id, const ApiSet::AsyncMode& mode = { false });
 
 		ApiSet getApiSet(const ApiSet::SyncMode& mode = { true });
+
+		ApiSet getApiSet(const uint64_t& id, const ApiSet::AutoMode& mode);
         
-        // 注册事件监听器
+        // 注册事件监听器，filter在派发前求值，未通过的事件直接丢弃
         template<Event::Concept E>
-		void onEvent(std::function<void(const E&)> callback);
+		void onEvent(std::function<void(const E&)> callback, Event::Filter filter = {});
+
+        // 注册协程事件监听器，协程必须按值接收事件，co_await ApiResult期间不占用线程，结果返回后在事件线程池中恢复
+        template<Event::Concept E, typename F>
+            requires std::same_as<std::invoke_result_t<F, E>, Task>
+        void onEvent(F callback, Event::Filter filter = {}) {
+            onEvent<E>(std::function<void(const E&)>([callback = std::move(callback)](const E& event) {
+                callback(event);
+            }), std::move(filter));
+        }
 
-        // [阻塞] 启动机器人
+        // 注册带快速操作的事件监听器，返回的json作为OneBot快速操作执行，返回null表示不操作
+        // HTTP上报的事件直接写入HTTP响应，WS上的事件通过.handle_quick_operation执行
+        template<Event::Concept E, typename F>
+            requires std::same_as<std::invoke_result_t<F, const E&>, nlohmann::json>
+        void onEvent(F callback, Event::Filter filter = {}) {
+            addHandler(E::getType(), [callback = std::move(callback)](const Event::Variant& event) {
+                return callback(*std::get_if<E>(&event));
+            }, std::move(filter));
+        }
+
+        // [阻塞] 启动机器人，同一端口同时接收反向WS连接和HTTP POST上报，标准输入关闭后停止
         void start();
 
-        ~BotInstance() = default;
+        // 启动机器人，开始监听后立即返回
+        void startAsync();
+
+        // 停止接受连接和派发新事件，在timeout内等待已派发的事件和未完成的API调用，
+        // 然后关闭所有会话，仍未完成的调用以失败结束；返回是否在timeout内排空
+        bool stop(std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
+        using TimerId = uint64_t;
+        // 一次性定时器，回调在事件线程池中执行；启动前就到期的定时器在启动后立即执行
+        TimerId runAfter(std::chrono::milliseconds delay, Job job);
+        // 周期定时器，按固定节拍执行，不随回调耗时漂移
+        TimerId runEvery(std::chrono::milliseconds period, Job job);
+        // 返回定时器是否在执行前被取消，周期定时器总是可以取消
+        bool cancel(TimerId id);
+
+        // 注册持久化定时器的处理函数，必须在startAsync()之前注册，name在重启前后保持一致
+        void onTimer(const std::string& name, std::function<void(const nlohmann::json& payload)> handler);
+        // 持久化的一次性定时器，连同payload写入Config::timer_store，进程重启后重新加载，
+        // 停机期间到期的在启动后立即执行；处理函数结束后才删除记录，所以崩溃时可能重复执行一次
+        TimerId runAfterPersistent(std::chrono::milliseconds delay, const std::string& name, nlohmann::json payload = {});
+
+        // 查询机器人的连接状态
+        ConnState getConnState(uint64_t id) const;
+
+        // 查询账号的排队深度和处理耗时，消息和通知两个通道合计
+        TenantStats getTenantStats(uint64_t self_id) const;
+
+        // 查询传输通道的调用统计
+        TransportStats getTransportStats(Transport transport) const;
+
+        // 单独设置某类事件监听器的预算，例如setHandlerBudget(Event::GroupMsg::getType(), 200ms)；没有设置Config::watchdog时忽略
+        void setHandlerBudget(const EventType& type, std::chrono::milliseconds budget);
+
+        // 查询某类事件监听器的耗时分位数和超出预算的次数，没有设置Config::watchdog时为空
+        HandlerStats getHandlerStats(const EventType& type) const;
+
+        // 按message_id查询存储的消息，找到时在持有读锁的情况下调用visitor；没有设置Config::message_store时返回false
+        bool findMessage(uint64_t self_id, int64_t message_id, const std::function<void(const StoredMessage&)>& visitor) const;
+
+        // 按时间顺序遍历群里time在[from, to]内的消息(秒级时间戳)，visitor返回false时停止，返回遍历的条数
+        // 多个账号在同一个群里时每个账号收到的消息各存一份，用self_id区分
+        std::size_t groupHistory(uint64_t group_id, int64_t from, int64_t to, const std::function<bool(const StoredMessage&)>& visitor) const;
+
+        // 在全文索引中查找消息，没有设置Config::search时返回空
+        std::vector<SearchHit> searchMessages(const SearchQuery& query) const;
+
+        // 以Chrome trace event格式导出最近抽样的事件：解码、派发、排队、监听器和其中发出的API调用
+        // 没有设置Config::trace时返回空的traceEvents
+        std::string dumpTrace() const;
+
+        ~BotInstance();
     protected:
         Config config;
-        std::unordered_map<EventType, Callback> event_callbacks{};
+        std::unordered_map<EventType, Handler> event_callbacks{};
+        std::shared_ptr<BotContext> context;
+        std::unordered_map<std::string, std::function<void(const nlohmann::json&)>> timer_handlers{};
+        bool timers_loaded = false;
     protected:
-        explicit BotInstance(const Config &config);
+        BotInstance(const Config &config, std::shared_ptr<Runtime> runtime);
+
+        // 快速操作的回写方式，context为原始事件，operation为监听器的返回值
+        using QuickReply = std::function<void(const EventJson& context, const nlohmann::json& operation)>;
+
+        void addHandler(const EventType& type, Callback callback, Event::Filter filter);
+
+        // 解码并派发一条来自WS的消息，反向WS和正向WS共用；is_client表示会话是正向WS客户端
+        void handlePayload(const std::string& payload, const std::shared_ptr<brynet::net::http::HttpSession>& session, bool is_client = false);
+
+        // 把WS上的API响应交给按echo.seq登记的调用，没有等待的调用时忽略
+        void handleResponse(const std::string& payload);
+
+        // 解码并派发一条HTTP POST上报的事件，监听器结束后通过reply写回响应
+        void handlePost(const std::string& body, const QuickReply& reply);
+
+        // 过滤、构造事件并投递到线程池，有总线订阅者时先发布到事件总线；
+        // 本进程没有监听器、被过滤或重复时返回false，此时reply不会被调用
+        // arena为解码payload的内存池，随事件一起释放；trace为抽样到的追踪记录
+        bool dispatchEvent(const EventType& type, EventJson& payload, QuickReply reply, std::shared_ptr<EventArena> arena = nullptr, std::shared_ptr<EventTrace> trace = nullptr);
+
+        // 持久化定时器到期时执行的任务，key为TimerStore中的记录
+        Job persistentJob(uint64_t key, std::string name, nlohmann::json payload);
 
         friend std::default_delete<BotInstance>;
     };
@@ -0,0 +1,227 @@
+#include "watchdog.hh"
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+namespace twobot {
+    namespace {
+        std::string _name(const EventType& type) {
+            return std::string(type.post_type) + "." + std::string(type.sub_type);
+        }
+
+        double _ms(std::chrono::steady_clock::duration duration) {
+            return std::chrono::duration<double, std::milli>(duration).count();
+        }
+    }
+
+    Watchdog::Watchdog(const WatchdogConfig& config)
+        : m_config(config)
+    {
+        if (m_config.interval.count() <= 0)
+            m_config.interval = std::chrono::milliseconds(100);
+    }
+
+    Watchdog::~Watchdog() {
+        stop();
+    }
+
+    void Watchdog::start() {
+        std::lock_guard lock(m_mtx);
+        if (m_thread.joinable())
+            return;
+        m_stopping = false;
+        m_thread = std::thread([this] { run(); });
+    }
+
+    void Watchdog::stop() {
+        {
+            std::lock_guard lock(m_mtx);
+            if (!m_thread.joinable())
+                return;
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+
+    double Watchdog::bucketUpper(std::size_t bucket) {
+        return 0.01 * std::exp2(bucket / 4.0);
+    }
+
+    std::size_t Watchdog::bucketOf(double ms) {
+        if (ms <= 0.01)
+            return 0;
+        auto bucket = static_cast<std::size_t>(std::ceil(std::log2(ms / 0.01) * 4));
+        return std::min(bucket, BUCKETS - 1);
+    }
+
+    Watchdog::Entry& Watchdog::entry(const EventType& type) {
+        {
+            std::shared_lock lock(m_entriesMtx);
+            auto it = m_entries.find(type);
+            if (it != m_entries.end())
+                return *it->second;
+        }
+        std::unique_lock lock(m_entriesMtx);
+        auto& entry = m_entries[type];
+        if (!entry)
+            entry = std::make_unique<Entry>();
+        return *entry;
+    }
+
+    void Watchdog::setBudget(const EventType& type, std::chrono::milliseconds budget) {
+        auto& e = entry(type);
+        std::lock_guard lock(e.mtx);
+        e.budget = budget;
+    }
+
+    bool Watchdog::quarantined(const EventType& type) const {
+        Entry* e = nullptr;
+        {
+            std::shared_lock lock(m_entriesMtx);
+            auto it = m_entries.find(type);
+            if (it == m_entries.end())
+                return false;
+            e = it->second.get();
+        }
+        return e->quarantined.load(std::memory_order_acquire) && release(type, *e);
+    }
+
+    bool Watchdog::release(const EventType& type, Entry& e) const {
+        if (m_config.quarantine_for.count() <= 0)
+            return true;
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        if (now < e.release_at.load(std::memory_order_relaxed))
+            return true;
+        {
+            std::lock_guard lock(e.mtx);
+            if (!e.quarantined.exchange(false))
+                return false;
+            e.consecutive = 0;
+            e.probation = m_config.quarantine_after;
+        }
+        std::cerr << "Handler Released: " << _name(type)
+            << " back to its lane after " << m_config.quarantine_for.count() << "ms, on probation for "
+            << m_config.quarantine_after << " calls" << std::endl;
+        return false;
+    }
+
+    HandlerStats Watchdog::stats(const EventType& type) const {
+        Entry* e = nullptr;
+        {
+            std::shared_lock lock(m_entriesMtx);
+            auto it = m_entries.find(type);
+            if (it == m_entries.end())
+                return {};
+            e = it->second.get();
+        }
+        std::lock_guard lock(e->mtx);
+        HandlerStats stats;
+        stats.calls = e->calls;
+        stats.over_budget = e->over_budget;
+        stats.max_ms = e->max_ms;
+        stats.budget_ms = static_cast<double>((e->budget.count() > 0 ? e->budget : m_config.budget).count());
+        stats.quarantined = e->quarantined;
+        // 取第一个累计数达到rank的桶的上界，不超过实际最大值
+        auto percentile = [&](double p) {
+            auto rank = static_cast<uint64_t>(std::ceil(p * e->calls));
+            uint64_t seen = 0;
+            for (std::size_t i = 0; i < BUCKETS; ++i) {
+                seen += e->histogram[i];
+                if (seen >= rank && seen > 0)
+                    return std::min(bucketUpper(i), e->max_ms);
+            }
+            return e->max_ms;
+        };
+        stats.p50_ms = percentile(0.5);
+        stats.p90_ms = percentile(0.9);
+        stats.p99_ms = percentile(0.99);
+        return stats;
+    }
+
+    uint64_t Watchdog::enter(const EventType& type, const Keys& keys) {
+        auto& e = entry(type);
+        std::chrono::milliseconds budget;
+        {
+            std::lock_guard lock(e.mtx);
+            budget = e.budget.count() > 0 ? e.budget : m_config.budget;
+        }
+        std::lock_guard lock(m_mtx);
+        auto token = m_next++;
+        m_running.emplace(token, Running{ type, &e, keys, std::chrono::steady_clock::now(), budget });
+        return token;
+    }
+
+    void Watchdog::leave(uint64_t token) {
+        auto now = std::chrono::steady_clock::now();
+        Running running;
+        {
+            std::lock_guard lock(m_mtx);
+            auto it = m_running.find(token);
+            if (it == m_running.end())
+                return;
+            running = it->second;
+            m_running.erase(it);
+        }
+        auto elapsed = now - running.start;
+        auto ms = _ms(elapsed);
+        auto& e = *running.entry;
+        bool quarantine = false;
+        {
+            std::lock_guard lock(e.mtx);
+            ++e.calls;
+            ++e.histogram[bucketOf(ms)];
+            e.max_ms = std::max(e.max_ms, ms);
+            if (elapsed > running.budget) {
+                ++e.over_budget;
+                ++e.consecutive;
+                // 观察期内超出一次就重新隔离
+                quarantine = m_config.quarantine_after > 0
+                    && (e.consecutive >= m_config.quarantine_after || e.probation > 0)
+                    && !e.quarantined.load(std::memory_order_relaxed);
+                if (quarantine) {
+                    e.probation = 0;
+                    // 先写到期时间再置位，quarantined()看到置位时一定能看到新的到期时间
+                    e.release_at.store((now + m_config.quarantine_for).time_since_epoch().count(), std::memory_order_relaxed);
+                    e.quarantined.store(true, std::memory_order_release);
+                }
+            }
+            else {
+                e.consecutive = 0;
+                if (e.probation > 0)
+                    --e.probation;
+            }
+        }
+        if (quarantine)
+            std::cerr << "Handler Quarantined: " << _name(running.type)
+                << " exceeded its budget of " << running.budget.count() << "ms, moved to the background lane" << std::endl;
+    }
+
+    void Watchdog::run() {
+        std::unique_lock lock(m_mtx);
+        while (!m_cv.wait_for(lock, m_config.interval, [this] { return m_stopping; })) {
+            auto now = std::chrono::steady_clock::now();
+            std::vector<std::pair<Running, double>> slow;
+            for (auto& [token, running] : m_running) {
+                if (running.reported || now - running.start <= running.budget)
+                    continue;
+                running.reported = true;
+                slow.emplace_back(running, _ms(now - running.start));
+            }
+            if (slow.empty())
+                continue;
+            // 打印时不持有锁，避免阻塞监听器的登记
+            lock.unlock();
+            for (auto& [running, ms] : slow) {
+                std::cerr << "Slow Handler: " << _name(running.type)
+                    << " self_id=" << running.keys.self_id
+                    << " user_id=" << running.keys.user_id
+                    << " group_id=" << running.keys.group_id
+                    << " message_id=" << running.keys.message_id
+                    << " running for " << static_cast<int64_t>(ms) << "ms"
+                    << ", budget " << running.budget.count() << "ms" << std::endl;
+            }
+            lock.lock();
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include "twobot.hh"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace twobot {
+    // 按事件类型统计监听器耗时，后台线程定期检查正在执行的监听器，超出预算的打印一次事件类型和相关的id
+    // 连续超出预算达到quarantine_after次的监听器被隔离，期间它的事件都进入BACKGROUND通道，quarantine_for之后放回原来的通道观察
+    class Watchdog {
+    public:
+        // 报告超时时附带的id，事件中没有的为0
+        struct Keys {
+            uint64_t self_id = 0;
+            uint64_t user_id = 0;
+            uint64_t group_id = 0;
+            int64_t message_id = 0;
+        };
+
+        explicit Watchdog(const WatchdogConfig& config);
+        ~Watchdog();
+
+        void start();
+        void stop();
+
+        void setBudget(const EventType& type, std::chrono::milliseconds budget);
+        bool quarantined(const EventType& type) const;
+        HandlerStats stats(const EventType& type) const;
+
+        // 监听器开始执行时登记，返回的序号交给leave()
+        uint64_t enter(const EventType& type, const Keys& keys);
+        void leave(uint64_t token);
+
+    private:
+        // 对数分桶，每个桶的上界是前一个的2^(1/4)倍，从10us到约2.4分钟，更长的计入最后一个桶，分位数误差在19%以内
+        static constexpr std::size_t BUCKETS = 96;
+        static double bucketUpper(std::size_t bucket);
+        static std::size_t bucketOf(double ms);
+
+        struct Entry {
+            std::chrono::milliseconds budget{ 0 }; // 0表示使用默认预算
+            std::atomic<bool> quarantined{ false };
+            std::atomic<int64_t> release_at{ 0 }; // 隔离结束的时间，steady_clock的纳秒数
+            std::mutex mtx;
+            std::array<uint64_t, BUCKETS> histogram{};
+            uint64_t calls = 0;
+            uint64_t over_budget = 0;
+            uint32_t consecutive = 0; // 连续超出预算的次数
+            uint32_t probation = 0;   // 解除隔离后还要观察的执行次数
+            double max_ms = 0;
+        };
+
+        struct Running {
+            EventType type;
+            Entry* entry = nullptr;
+            Keys keys;
+            std::chrono::steady_clock::time_point start;
+            std::chrono::milliseconds budget{ 0 };
+            bool reported = false;
+        };
+
+        Entry& entry(const EventType& type);
+        // 隔离到期时解除，返回是否仍在隔离
+        bool release(const EventType& type, Entry& e) const;
+        void run();
+
+        WatchdogConfig m_config;
+
+        mutable std::shared_mutex m_entriesMtx;
+        std::unordered_map<EventType, std::unique_ptr<Entry>> m_entries;
+
+        std::mutex m_mtx;
+        std::condition_variable m_cv;
+        std::unordered_map<uint64_t, Running> m_running;
+        uint64_t m_next = 1;
+        bool m_stopping = false;
+        std::thread m_thread;
+    };
+
+    // 监听器执行期间登记到看门狗，离开作用域时注销，监听器抛出异常时也不会一直留在执行列表中；watchdog为空时什么也不做
+    class WatchdogScope {
+    public:
+        WatchdogScope(Watchdog* watchdog, const EventType& type, const Watchdog::Keys& keys)
+            : m_watchdog(watchdog), m_token(watchdog ? watchdog->enter(type, keys) : 0) {}
+        ~WatchdogScope() {
+            if (m_token)
+                m_watchdog->leave(m_token);
+        }
+
+        WatchdogScope(const WatchdogScope&) = delete;
+        WatchdogScope& operator=(const WatchdogScope&) = delete;
+
+    private:
+        Watchdog* m_watchdog;
+        uint64_t m_token;
+    };
+}